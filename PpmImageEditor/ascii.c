@@ -0,0 +1,230 @@
+#include "platform.h"
+#include "ascii.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#ifdef HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+#define ASCII_BLOCK 16 // Bytes classified at once
+#define ASCII_PER_LINE 17 // Values per line of text, 17 values of 3 digits fit the 70 columns limit
+#define ASCII_PER_LINE_16 11 // Values per line of text with values of 5 digits
+
+// Text of every 8-bits value followed by a space, with its length
+static char asciiValues[256][4];
+static unsigned char asciiLengths[256];
+// Text of every number from 00 to 99, 16-bits values are written two digits at a time
+static char asciiPairs[100][2];
+static pthread_once_t asciiOnce = PTHREAD_ONCE_INIT; // The batch writes files on many threads
+
+// Classify the bytes of a block: bit k of digits/spaces is set when byte k is a digit/whitespace
+static void classifyBlock(const unsigned char *p, unsigned int *digits, unsigned int *spaces)
+{
+#ifdef HAVE_SSE2
+	__m128i block = _mm_loadu_si128((const __m128i *)p);
+	__m128i digit = _mm_sub_epi8(block, _mm_set1_epi8('0'));
+	__m128i control = _mm_sub_epi8(block, _mm_set1_epi8('\t'));
+
+	// digits are the bytes with an unsigned distance to '0' of 9 or less,
+	// whitespaces are ' ' and the bytes from '\t' to '\r'
+	digit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+	control = _mm_cmpeq_epi8(_mm_min_epu8(control, _mm_set1_epi8(4)), control);
+	*digits = (unsigned int)_mm_movemask_epi8(digit);
+	*spaces = (unsigned int)_mm_movemask_epi8(_mm_or_si128(control, _mm_cmpeq_epi8(block, _mm_set1_epi8(' '))));
+#else
+	int k;
+
+	*digits = *spaces = 0;
+	for (k = 0; k < ASCII_BLOCK; k++) {
+		*digits |= (unsigned int)((unsigned char)(p[k] - '0') <= 9) << k;
+		*spaces |= (unsigned int)(p[k] == ' ' || (unsigned char)(p[k] - '\t') <= 4) << k;
+	}
+#endif
+}
+
+void readAsciiPixels(FILE *fp, const char *filename, Image *img, int maxval)
+{
+	unsigned char *buff, *row;
+	unsigned short *row16;
+	unsigned int digits, spaces, rest, value = 0;
+	size_t length = 0, pos, got;
+	int i = 0, j = 0, k, end, numberDigits = 0, rowSamples = (int)imageRowSamples(img), eof = 0;
+
+	buff = (unsigned char *)malloc(ASCII_BUFFER + ASCII_BLOCK);
+	if (!buff) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	row = img->data;
+	row16 = (unsigned short *)img->data;
+	while (j < img->y) {
+		// fill the buffer after the bytes left from the last pass
+		got = fread(buff + length, 1, ASCII_BUFFER - length, fp);
+		if (got == 0) {
+			if (eof) {
+				fprintf(stderr, "Truncated pixel data (error loading '%s')\n", filename);
+				exit(1);
+			}
+
+			// pad the end of the file with spaces to a whole block, ending the last value
+			eof = 1;
+			got = ASCII_BLOCK - length % ASCII_BLOCK;
+			memset(buff + length, ' ', got);
+		}
+		length += got;
+
+		for (pos = 0; pos + ASCII_BLOCK <= length && j < img->y; pos += ASCII_BLOCK) {
+			classifyBlock(buff + pos, &digits, &spaces);
+			if ((digits | spaces) != (1u << ASCII_BLOCK) - 1) {
+				fprintf(stderr, "Invalid pixel value (error loading '%s')\n", filename);
+				exit(1);
+			}
+
+			// the masks give whole runs of digits, so the only loop per character is the conversion
+			k = 0;
+			while (k < ASCII_BLOCK) {
+				if (!numberDigits) {
+					rest = digits >> k;
+					if (!rest)
+						break;
+					k += countTrailingZeros(rest);
+				}
+
+				rest = spaces >> k;
+				end = rest ? k + countTrailingZeros(rest) : ASCII_BLOCK;
+				numberDigits += end - k;
+				for (; k < end; k++)
+					value = value * 10 + (buff[pos + k] - '0');
+
+				// the value goes on in the next block
+				if (end == ASCII_BLOCK)
+					break;
+
+				if (numberDigits > 5 || value > (unsigned int)maxval) {
+					fprintf(stderr, "Invalid pixel value (error loading '%s')\n", filename);
+					exit(1);
+				}
+
+				if (img->depth == 1)
+					row[i++] = (unsigned char)value;
+				else
+					row16[i++] = (unsigned short)value;
+				value = 0;
+				numberDigits = 0;
+				if (i == rowSamples) {
+					i = 0;
+					if (++j == img->y)
+						break;
+					row = (unsigned char *)imageRow(img, j);
+					row16 = imageSamples16(img, j);
+				}
+			}
+		}
+
+		// keep the incomplete block for the next pass
+		memmove(buff, buff + pos, length - pos);
+		length -= pos;
+	}
+
+	free(buff);
+}
+
+static void initAsciiValues(void)
+{
+	int v, length;
+
+	for (v = 0; v < 256; v++) {
+		length = 0;
+		if (v >= 100)
+			asciiValues[v][length++] = (char)('0' + v / 100);
+		if (v >= 10)
+			asciiValues[v][length++] = (char)('0' + v / 10 % 10);
+		asciiValues[v][length++] = (char)('0' + v % 10);
+		asciiValues[v][length++] = ' ';
+		asciiLengths[v] = (unsigned char)length;
+	}
+
+	for (v = 0; v < 100; v++) {
+		asciiPairs[v][0] = (char)('0' + v / 10);
+		asciiPairs[v][1] = (char)('0' + v % 10);
+	}
+}
+
+// Write a value of up to 5 digits followed by a space, returns the length written
+static int formatValue16(char *p, unsigned int value)
+{
+	char digits[6];
+	int n = 6, length;
+
+	while (value >= 100) {
+		n -= 2;
+		memcpy(digits + n, asciiPairs[value % 100], 2);
+		value /= 100;
+	}
+	if (value >= 10) {
+		n -= 2;
+		memcpy(digits + n, asciiPairs[value], 2);
+	}
+	else
+		digits[--n] = (char)('0' + value);
+
+	length = 6 - n;
+	memcpy(p, digits + n, length);
+	p[length] = ' ';
+	return length + 1;
+}
+
+void writeImageAscii(const Image *img, const char *filename)
+{
+	FILE *fp;
+	char *buff, *tempName;
+	const unsigned char *row;
+	const unsigned short *row16;
+	size_t length = 0;
+	int i, j, column = 0, rowSamples = (int)imageRowSamples(img);
+	int perLine = img->depth == 1 ? ASCII_PER_LINE : ASCII_PER_LINE_16;
+
+	// the length of the text isn't known before formatting it, so nothing is preallocated
+	fp = createOutputFile(filename, &tempName, 0);
+
+	// a line is never split between two writes, so the buffer has room for one more line
+	buff = (char *)malloc(ASCII_BUFFER + 4 * ASCII_PER_LINE + 4);
+	if (!buff) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	pthread_once(&asciiOnce, initAsciiValues);
+	writeImageHeader(fp, img->channels == 3 ? '3' : '2', img->x, img->y, img->maxval);
+
+	// 8-bits values are copied from the table 4 bytes at a time, only the length depends on the value
+	for (j = 0; j < img->y; j++) {
+		row = imageSamples(img, j);
+		row16 = imageSamples16(img, j);
+		for (i = 0; i < rowSamples; i++) {
+			if (img->depth == 1) {
+				memcpy(buff + length, asciiValues[row[i]], 4);
+				length += asciiLengths[row[i]];
+			}
+			else
+				length += formatValue16(buff + length, row16[i]);
+			if (++column == perLine) {
+				buff[length - 1] = '\n';
+				column = 0;
+			}
+			if (length >= ASCII_BUFFER && !column) {
+				fwrite(buff, 1, length, fp);
+				length = 0;
+			}
+		}
+	}
+
+	if (column)
+		buff[length - 1] = '\n';
+	fwrite(buff, 1, length, fp);
+
+	free(buff);
+	commitOutputFile(fp, filename, tempName);
+}
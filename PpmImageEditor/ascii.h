@@ -0,0 +1,15 @@
+#ifndef ASCII_H
+#define ASCII_H
+
+#include "image.h"
+
+#define ASCII_BUFFER (1 << 20) // Bytes of text parsed or formatted per read or write call
+
+// Decode the ASCII (P3 or P2) pixels of img from fp, which must be right after the header.
+// The input is read in large blocks, so fp is left past the end of the pixels.
+void readAsciiPixels(FILE *fp, const char *filename, Image *img, int maxval);
+
+// Write img as an ASCII file, P3 for RGB images and P2 for grayscale images
+void writeImageAscii(const Image *img, const char *filename);
+
+#endif
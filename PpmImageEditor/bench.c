@@ -0,0 +1,654 @@
+#include "platform.h"
+#include "image.h"
+#include "filters.h"
+#include "parallel.h"
+#include "integral.h"
+#include "simd.h"
+#include "tile.h"
+#include "pointops.h"
+#include "pipeline.h"
+#include "resize.h"
+#include "orient.h"
+#include "stream.h"
+#include "ascii.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Benchmark of the read, filter and write stages on synthetic images.
+// Every stage runs warm-up passes then timed passes, the median and the 95th percentile of
+// the timed passes are reported with the pixel rates. Filters run once per thread count.
+
+#define MAX_SIZES 16
+#define MAX_THREADS 16
+#define MAX_RUNS 1000
+
+// Structure for the benchmark settings
+typedef struct {
+	int sizes[MAX_SIZES][2];
+	int sizeCount;
+	int threads[MAX_THREADS];
+	int threadCount;
+	int channels;
+	int maxval;
+	int runs;
+	int warmup;
+	const char *dir;
+} Bench;
+
+// Stage being measured, img is the image it works on and filename the file it reads or writes
+typedef struct {
+	const char *name;
+	void (*run)(Image *img, const char *filename);
+	int threaded;
+} Stage;
+
+static Image *source; // Synthetic image the filters start from on every pass
+static int *radiusMap; // Radii of the boxvarying stage, from 0 at the top row to twice the blur radius at the bottom
+static size_t peakMemory; // Bytes of buffers the last pass of a stage used, for the stages that report them
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: bench [-s WxH]... [-j threads]... [-c channels] [-v maxval] [-r runs] [-w warmup] [-d dir] [-i isa] [-t WxH]\n"
+		"       bench -k\n"
+		"  -s WxH      image size, repeat it to measure more sizes, 640x480, 1920x1080 and 3840x2160 by default\n"
+		"  -j threads  thread count of the filters, repeat it to compare counts, powers of 2 up to the processors by default\n"
+		"  -c channels 3 for PPM images (default) or 1 for PGM images\n"
+		"  -v maxval   maximum value of the samples, 255 by default, above 255 the samples take 16 bits\n"
+		"  -r runs     timed passes of each stage, 11 by default\n"
+		"  -w warmup   untimed passes before them, 2 by default\n"
+		"  -d dir      directory of the file read and written, the current directory by default\n"
+		"  -i isa      widest instruction set of the kernels: scalar, sse2, avx2 or avx512 (default)\n"
+		"  -t WxH      tile size of the Gaussian blur, 0 picks a side from the L2 cache size (default)\n"
+		"  -k          check that chains of point operations match the operations run one after the other\n");
+	exit(1);
+}
+
+// Fill img with gradients and noise, the same for every run of the benchmark
+static void generateImage(Image *img)
+{
+	unsigned int seed = 2463534242u, value;
+	size_t rowSamples = imageRowSamples(img), i;
+	int j;
+
+	for (j = 0; j < img->y; j++) {
+		unsigned char *row = imageSamples(img, j);
+		unsigned short *row16 = imageSamples16(img, j);
+		for (i = 0; i < rowSamples; i++) {
+			// xorshift noise over a diagonal gradient
+			seed ^= seed << 13;
+			seed ^= seed >> 17;
+			seed ^= seed << 5;
+			value = (unsigned int)((i / img->channels + j) * (size_t)img->maxval / (img->x + img->y));
+			value = (value * 3 + seed % (img->maxval + 1)) / 4;
+			if (img->depth == 1)
+				row[i] = (unsigned char)value;
+			else
+				row16[i] = (unsigned short)value;
+		}
+	}
+}
+
+// Chains of 6 random point operations against the same operations run one after the other, each
+// as a chain of its own, for every sample size and channel count. Returns the chains that differ.
+static int checkPointChains(void)
+{
+	static const int maxvals[] = { 1, 255, 256, 4095, RGB_TOTAL_COLORS_16 };
+	PointChain *chain, *single;
+	Image *chained, *sequential;
+	PointOperation operations[6];
+	double a[6], b[6];
+	unsigned int seed = 2463534242u;
+	int m, channels, n, k, j, channel[6], checked = 0, differ = 0;
+
+	for (m = 0; m < (int)(sizeof(maxvals) / sizeof(maxvals[0])); m++) {
+		for (channels = 1; channels <= 3; channels += 2) {
+			for (n = 0; n < 20; n++) {
+				chained = createImage(61 + n, 13, channels, maxvals[m], n & 1);
+				sequential = createImage(61 + n, 13, channels, maxvals[m], n & 1);
+				if (!chained || !sequential) {
+					fprintf(stderr, "Unable to allocate memory\n");
+					exit(1);
+				}
+				generateImage(chained);
+				generateImage(sequential);
+
+				chain = createPointChain(channels, maxvals[m]);
+				for (k = 0; k < 6; k++) {
+					seed ^= seed << 13;
+					seed ^= seed >> 17;
+					seed ^= seed << 5;
+					operations[k] = (PointOperation)(seed % 6);
+					channel[k] = (int)(seed >> 8) % 4 - 1 < channels ? (int)(seed >> 8) % 4 - 1 : POINT_ALL_CHANNELS;
+					switch (operations[k]) {
+					case POINT_BRIGHTNESS:
+						a[k] = ((seed >> 12) % 200 - 100.0) / 200;
+						break;
+					case POINT_CONTRAST:
+						a[k] = (seed >> 12) % 300 / 100.0;
+						break;
+					case POINT_GAMMA:
+						a[k] = 0.3 + (seed >> 12) % 30 / 10.0;
+						break;
+					default:
+						a[k] = (seed >> 12) % 50 / 100.0;
+						break;
+					}
+					b[k] = 0.5 + (seed >> 20) % 50 / 100.0;
+					addPointOperation(chain, operations[k], channel[k], a[k], b[k]);
+
+					single = createPointChain(channels, maxvals[m]);
+					addPointOperation(single, operations[k], channel[k], a[k], b[k]);
+					applyPointChain(single, sequential);
+					freePointChain(single);
+				}
+				applyPointChain(chain, chained);
+				freePointChain(chain);
+
+				checked++;
+				for (j = 0; j < chained->y; j++) {
+					if (memcmp(imageSamples(chained, j), imageSamples(sequential, j), imageRowSize(chained)) != 0) {
+						differ++;
+						break;
+					}
+				}
+				freeImage(chained);
+				freeImage(sequential);
+			}
+		}
+	}
+
+	printf("point chains: %d checked, %d differ\n", checked, differ);
+	return differ;
+}
+
+static void copyImage(Image *dst, const Image *src)
+{
+	memcpy(dst->data, src->data, src->stride * src->y);
+}
+
+// Text copy of the file the read stages use, next to it
+static char *asciiName(const char *filename)
+{
+	size_t length = strlen(filename);
+	char *name = (char *)malloc(length + 7);
+
+	if (!name) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+	memcpy(name, filename, length);
+	memcpy(name + length, ".ascii", 7);
+	return name;
+}
+
+static void runRead(Image *img, const char *filename)
+{
+	freeImage(readImage(filename));
+	(void)img;
+}
+
+static void runReadMapped(Image *img, const char *filename)
+{
+	freeImage(readImageMapped(filename, img->depth == 2));
+}
+
+// Parsing and formatting of the text formats, P3 and P2
+static void runReadAscii(Image *img, const char *filename)
+{
+	char *name = asciiName(filename);
+
+	freeImage(readImage(name));
+	free(name);
+	(void)img;
+}
+
+static void runWriteAscii(Image *img, const char *filename)
+{
+	char *name = asciiName(filename);
+
+	writeImageAscii(img, name);
+	free(name);
+}
+
+static void runBlur(Image *img, const char *filename)
+{
+	filterGaussianBlur(img);
+	(void)filename;
+}
+
+static void runFastBlur(Image *img, const char *filename)
+{
+	filterFastGaussianBlur(img);
+	(void)filename;
+}
+
+// Blur of the centre of the image through a view, the rest of the image is left alone
+static void runRegionBlur(Image *img, const char *filename)
+{
+	Image *view = createImageView(img, img->x / 4, img->y / 4, img->x / 2, img->y / 2);
+
+	filterGaussianBlur(view);
+	freeImage(view);
+	(void)filename;
+}
+
+// Mean blur from the file to another file a band of rows at a time, its memory is reported
+static void runBandBlur(Image *img, const char *filename)
+{
+	size_t length = strlen(filename);
+	char *output = (char *)malloc(length + 6);
+
+	if (!output) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+	memcpy(output, filename, length);
+	memcpy(output + length, ".band", 6);
+	peakMemory = streamMeanBlur(filename, output, blurRadius());
+	remove(output);
+	free(output);
+	(void)img;
+}
+
+static void runBoxBlur(Image *img, const char *filename)
+{
+	filterBoxBlur(img);
+	(void)filename;
+}
+
+// Box blur of a radius per pixel, a tilt-shift like gradient
+static void runBoxBlurVarying(Image *img, const char *filename)
+{
+	filterBoxBlurVarying(img, radiusMap);
+	(void)filename;
+}
+
+static void runMeanBlur(Image *img, const char *filename)
+{
+	filterMeanBlur(img);
+	(void)filename;
+}
+
+static void runMedian(Image *img, const char *filename)
+{
+	filterMedian(img);
+	(void)filename;
+}
+
+static void runPoints(Image *img, const char *filename)
+{
+	PointChain *chain = createPointChain(img->channels, img->maxval);
+
+	// a typical correction, composed into a single pass
+	addPointOperation(chain, POINT_BRIGHTNESS, POINT_ALL_CHANNELS, 0.1, 0);
+	addPointOperation(chain, POINT_CONTRAST, POINT_ALL_CHANNELS, 1.2, 0);
+	addPointOperation(chain, POINT_GAMMA, POINT_ALL_CHANNELS, 2.2, 0);
+	applyPointChain(chain, img);
+	freePointChain(chain);
+	(void)filename;
+}
+
+// Filters of the chain and pipeline stages, a cleanup of a scanned negative
+static void chainFilters(Image *img)
+{
+	PointChain *chain = createPointChain(img->channels, img->maxval);
+
+	addPointOperation(chain, POINT_GAMMA, POINT_ALL_CHANNELS, 2.2, 0);
+	filterChangeColor(img);
+	filterMedian(img);
+	filterGaussianBlur(img);
+	applyPointChain(chain, img);
+	freePointChain(chain);
+}
+
+// Both stages filter a copy of the image and copy the result back, so they only differ in the
+// passes over the image: one per filter for the chain, one for the whole pipeline.
+static void runChain(Image *img, const char *filename)
+{
+	Image *copy = createImage(img->x, img->y, img->channels, img->maxval, 0);
+
+	if (!copy) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+	copyImageRect(copy, 0, 0, img, 0, 0, img->x, img->y);
+	chainFilters(copy);
+	copyImageRect(img, 0, 0, copy, 0, 0, img->x, img->y);
+	freeImage(copy);
+	(void)filename;
+}
+
+static void runPipelineStage(Image *img, const char *filename)
+{
+	Pipeline *pipeline = createPipeline();
+	Image *copy = createImage(img->x, img->y, img->channels, img->maxval, 0);
+
+	if (!copy) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+	pipelinePoint(pipeline, POINT_INVERT, POINT_ALL_CHANNELS, 0, 0);
+	pipelineMedian(pipeline, blurRadius());
+	pipelineGaussianBlur(pipeline, blurSigma());
+	pipelinePoint(pipeline, POINT_GAMMA, POINT_ALL_CHANNELS, 2.2, 0);
+
+	copyImageRect(copy, 0, 0, img, 0, 0, img->x, img->y);
+	copy = runPipeline(pipeline, copy);
+	copyImageRect(img, 0, 0, copy, 0, 0, img->x, img->y);
+	freeImage(copy);
+	freePipeline(pipeline);
+	(void)filename;
+}
+
+// Thumbnails and proxies, the resizes give a new image which is dropped
+static void runLanczos(Image *img, const char *filename)
+{
+	freeImage(resizeImage(img, img->x / 3, img->y / 3, RESIZE_LANCZOS));
+	(void)filename;
+}
+
+static void runBilinear(Image *img, const char *filename)
+{
+	freeImage(resizeImage(img, img->x / 2, img->y / 2, RESIZE_BILINEAR));
+	(void)filename;
+}
+
+static void runDecimate(Image *img, const char *filename)
+{
+	freeImage(decimateImage(img, 4));
+	(void)filename;
+}
+
+// Rotations and mirrors against a plain copy to a new image, the bandwidth they should reach
+static void runCopy(Image *img, const char *filename)
+{
+	Image *copy = createImage(img->x, img->y, img->channels, img->maxval, 0);
+
+	copyImageRect(copy, 0, 0, img, 0, 0, img->x, img->y);
+	freeImage(copy);
+	(void)filename;
+}
+
+static void runRotate90(Image *img, const char *filename)
+{
+	freeImage(orientImage(img, ORIENT_ROTATE_90));
+	(void)filename;
+}
+
+static void runRotate180(Image *img, const char *filename)
+{
+	freeImage(orientImage(img, ORIENT_ROTATE_180));
+	(void)filename;
+}
+
+static void runTranspose(Image *img, const char *filename)
+{
+	freeImage(orientImage(img, ORIENT_TRANSPOSE));
+	(void)filename;
+}
+
+static void runIntegral(Image *img, const char *filename)
+{
+	freeIntegralImage(createIntegralImage(img, 0));
+	(void)filename;
+}
+
+static void runMeanBlurInPlace(Image *img, const char *filename)
+{
+	filterMeanBlurInPlace(img);
+	(void)filename;
+}
+
+static void runInvert(Image *img, const char *filename)
+{
+	filterChangeColor(img);
+	(void)filename;
+}
+
+static void runWrite(Image *img, const char *filename)
+{
+	writeImage(img, filename);
+}
+
+static const Stage stages[] = {
+	{ "read", runRead, 0 },
+	{ "map", runReadMapped, 0 },
+	{ "ascread", runReadAscii, 0 },
+	{ "blur", runBlur, 1 },
+	{ "fastblur", runFastBlur, 1 },
+	{ "viewblur", runRegionBlur, 1 },
+	{ "box", runBoxBlur, 1 },
+	{ "boxvarying", runBoxBlurVarying, 1 },
+	{ "mean", runMeanBlur, 1 },
+	{ "band", runBandBlur, 0 },
+	{ "inplace", runMeanBlurInPlace, 1 },
+	{ "median", runMedian, 1 },
+	{ "integral", runIntegral, 1 },
+	{ "invert", runInvert, 1 },
+	{ "points", runPoints, 1 },
+	{ "chain", runChain, 1 },
+	{ "pipeline", runPipelineStage, 1 },
+	{ "lanczos", runLanczos, 1 },
+	{ "bilinear", runBilinear, 1 },
+	{ "decimate", runDecimate, 1 },
+	{ "copy", runCopy, 1 },
+	{ "rot90", runRotate90, 1 },
+	{ "rot180", runRotate180, 1 },
+	{ "transp", runTranspose, 1 },
+	{ "write", runWrite, 0 },
+	{ "ascwrite", runWriteAscii, 0 },
+};
+
+static int compareTimes(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+// Time a stage and print its line of the report
+static void measureStage(const Bench *bench, const Stage *stage, Image *img, const char *filename, int threads)
+{
+	double times[MAX_RUNS], start, median, p95;
+	ParallelStats counters;
+	double megapixels = (double)img->x * img->y / 1e6;
+	double megabytes = (double)imageRowSize(img) * img->y / 1e6;
+	int r, total = bench->warmup + bench->runs;
+
+	peakMemory = 0;
+	for (r = 0; r < total; r++) {
+		// the filters work in place, so they get the synthetic image back before each pass
+		copyImage(img, source);
+		if (r == bench->warmup)
+			resetParallelStats();
+		start = timerSeconds();
+		stage->run(img, filename);
+		if (r >= bench->warmup)
+			times[r - bench->warmup] = timerSeconds() - start;
+	}
+
+	qsort(times, bench->runs, sizeof(double), compareTimes);
+	median = bench->runs % 2 ? times[bench->runs / 2] : (times[bench->runs / 2 - 1] + times[bench->runs / 2]) / 2;
+	p95 = times[(bench->runs * 95 + 99) / 100 - 1];
+
+	if (threads)
+		printf("%-10s %5dx%-5d %7d", stage->name, img->x, img->y, threads);
+	else
+		printf("%-10s %5dx%-5d %7s", stage->name, img->x, img->y, "-");
+	printf(" %10.3f %10.3f %10.1f %10.1f", median * 1e3, p95 * 1e3, megapixels / median, megabytes / median);
+
+	// scheduler counters per pass, only the filters split in ranges have them
+	parallelStats(&counters);
+	if (threads && counters.ranges)
+		printf(" %8.1f %8.3f", (double)counters.steals / bench->runs, counters.idleSeconds * 1e3 / bench->runs);
+	else
+		printf(" %8s %8s", "-", "-");
+	if (peakMemory)
+		printf(" %8.2f\n", peakMemory / 1e6);
+	else
+		printf(" %8s\n", "-");
+	fflush(stdout);
+}
+
+static void measureSize(const Bench *bench, int x, int y)
+{
+	char *filename, *textName;
+	size_t dirLength = strlen(bench->dir);
+	Image *img;
+	int s, t, i, j;
+
+	source = createImage(x, y, bench->channels, bench->maxval, 0);
+	img = createImage(x, y, bench->channels, bench->maxval, 0);
+	radiusMap = (int *)malloc((size_t)x * y * sizeof(int));
+	if (!source || !img || !radiusMap) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+	generateImage(source);
+	for (j = 0; j < y; j++)
+		for (i = 0; i < x; i++)
+			radiusMap[(size_t)j * x + i] = (2 * blurRadius() + 1) * j / y;
+
+	filename = (char *)malloc(dirLength + 16);
+	if (!filename) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+	memcpy(filename, bench->dir, dirLength);
+	memcpy(filename + dirLength, bench->channels == 3 ? "/bench.ppm" : "/bench.pgm", 11);
+
+	// the read stages need the file on disk, in binary and as text
+	writeImage(source, filename);
+	textName = asciiName(filename);
+	writeImageAscii(source, textName);
+
+	for (s = 0; s < (int)(sizeof(stages) / sizeof(stages[0])); s++) {
+		if (!stages[s].threaded) {
+			measureStage(bench, &stages[s], img, filename, 0);
+			continue;
+		}
+		for (t = 0; t < bench->threadCount; t++) {
+			setParallelThreads(bench->threads[t]);
+			measureStage(bench, &stages[s], img, filename, bench->threads[t]);
+		}
+	}
+
+	remove(textName);
+	free(textName);
+	remove(filename);
+	free(filename);
+	free(radiusMap);
+	freeImage(img);
+	freeImage(source);
+}
+
+int main(int argc, char **argv)
+{
+	Bench bench;
+	char *end;
+	int i, t, width, height, processors = hardwareThreads();
+
+	memset(&bench, 0, sizeof(bench));
+	bench.channels = 3;
+	bench.maxval = RGB_TOTAL_COLORS;
+	bench.runs = 11;
+	bench.warmup = 2;
+	bench.dir = ".";
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-k") == 0)
+			return checkPointChains() != 0;
+		if (i + 1 == argc)
+			usage();
+		if (strcmp(argv[i], "-s") == 0) {
+			if (bench.sizeCount == MAX_SIZES)
+				usage();
+			bench.sizes[bench.sizeCount][0] = (int)strtol(argv[++i], &end, 10);
+			if (*end != 'x')
+				usage();
+			bench.sizes[bench.sizeCount][1] = (int)strtol(end + 1, &end, 10);
+			if (*end || bench.sizes[bench.sizeCount][0] <= 0 || bench.sizes[bench.sizeCount][1] <= 0)
+				usage();
+			bench.sizeCount++;
+		}
+		else if (strcmp(argv[i], "-j") == 0) {
+			if (bench.threadCount == MAX_THREADS)
+				usage();
+			bench.threads[bench.threadCount] = atoi(argv[++i]);
+			if (bench.threads[bench.threadCount++] < 1)
+				usage();
+		}
+		else if (strcmp(argv[i], "-c") == 0) {
+			bench.channels = atoi(argv[++i]);
+			if (bench.channels != 1 && bench.channels != 3)
+				usage();
+		}
+		else if (strcmp(argv[i], "-v") == 0) {
+			bench.maxval = atoi(argv[++i]);
+			if (bench.maxval < 1 || bench.maxval > RGB_TOTAL_COLORS_16)
+				usage();
+		}
+		else if (strcmp(argv[i], "-r") == 0) {
+			bench.runs = atoi(argv[++i]);
+			if (bench.runs < 1 || bench.runs > MAX_RUNS)
+				usage();
+		}
+		else if (strcmp(argv[i], "-w") == 0) {
+			bench.warmup = atoi(argv[++i]);
+			if (bench.warmup < 0)
+				usage();
+		}
+		else if (strcmp(argv[i], "-d") == 0) {
+			bench.dir = argv[++i];
+		}
+		else if (strcmp(argv[i], "-i") == 0) {
+			for (t = SIMD_SCALAR; t <= SIMD_AVX512 && strcmp(argv[i + 1], simdLevelName(t)) != 0; t++)
+				;
+			if (t > SIMD_AVX512)
+				usage();
+			setSimdLevel(t);
+			i++;
+		}
+		else if (strcmp(argv[i], "-t") == 0) {
+			width = (int)strtol(argv[++i], &end, 10);
+			if (*end != 'x')
+				usage();
+			height = (int)strtol(end + 1, &end, 10);
+			if (*end || width < 0 || height < 0)
+				usage();
+			setTileSize(width, height);
+		}
+		else
+			usage();
+	}
+
+	if (bench.sizeCount == 0) {
+		bench.sizes[0][0] = 640;
+		bench.sizes[0][1] = 480;
+		bench.sizes[1][0] = 1920;
+		bench.sizes[1][1] = 1080;
+		bench.sizes[2][0] = 3840;
+		bench.sizes[2][1] = 2160;
+		bench.sizeCount = 3;
+	}
+
+	if (bench.threadCount == 0) {
+		for (t = 1; t < processors && bench.threadCount < MAX_THREADS - 1; t *= 2)
+			bench.threads[bench.threadCount++] = t;
+		bench.threads[bench.threadCount++] = processors;
+	}
+
+	// the pool must hold the largest count, the benchmark thread being one of them
+	for (t = 0; t < bench.threadCount; t++)
+		if (bench.threads[t] - 1 > poolThreads())
+			setPoolThreads(bench.threads[t] - 1);
+
+	printf("kernels: %s\n", simdLevelName(simdKernels()->level));
+	printf("%-10s %11s %7s %10s %10s %10s %10s %8s %8s %8s\n", "stage", "size", "threads", "median ms", "p95 ms", "MP/s",
+		"MB/s", "steals", "idle ms", "peak MB");
+	for (i = 0; i < bench.sizeCount; i++)
+		measureSize(&bench, bench.sizes[i][0], bench.sizes[i][1]);
+
+	return 0;
+}
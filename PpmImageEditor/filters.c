@@ -0,0 +1,812 @@
+#include "filters.h"
+#include "parallel.h"
+#include "integral.h"
+#include "simd.h"
+#include "tile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define MEAN_SPECIALIZED_RADIUS 8 // Largest radius with its own mean blur kernels
+#define MEAN_TOTAL_BITS 25 // Bits of the window totals of these kernels, (2 * 8 + 1)^2 samples of 16 bits
+
+// Every component is inverted the same way, so rows are walked as runs of components.
+// This covers RGB and grayscale images alike.
+static void rangeChangeColor(void *arg, int start, int end, int worker)
+{
+	Image *img = (Image *)arg;
+	const SimdKernels *kernels = simdKernels();
+	size_t samples = imageRowSamples(img);
+	int j;
+
+	(void)worker;
+	for (j = start; j < end; j++) {
+		if (img->depth == 1)
+			kernels->invert(imageSamples(img, j), samples, img->maxval);
+		else
+			kernels->invert16(imageSamples16(img, j), samples, img->maxval);
+	}
+}
+
+void filterChangeColor(Image *img)
+{
+	if (img)
+		parallelFor(0, img->y, 0, rangeChangeColor, img);
+}
+
+// Blur the columns startX to endX of an image, for one component type and number of channels.
+// Totals are int for 8-bits components and long long for 16-bits components, so the
+// sums can't overflow whatever the blur level.
+#define DEFINE_BLUR_COLUMNS(name, Sample, Total, CHANNELS) \
+static void name(Image *img, int startX, int endX) \
+{ \
+	int i = 0, j = 0, x = 0, y = 0, c = 0, pixelLenght = 0, pixelSquare = 0; \
+	Total total[CHANNELS]; \
+	Sample average[CHANNELS], *pixel; \
+ \
+	pixelSquare = BLUR_LEVEL * 2 + 1; /* one side of the pixels square based on the level */ \
+	pixelLenght = pixelSquare * pixelSquare; /* total pixels per blur level */ \
+ \
+	/* Go line by line */ \
+	for (i = startX; i < endX; i++) { \
+		/* Go row by row */ \
+		for (j = 0; j < img->y; j++) { \
+			for (c = 0; c < CHANNELS; c++) \
+				total[c] = 0; /* needs to restart the color sum */ \
+ \
+			/* Now based on the blur level it will get each neighbor pixel */ \
+			for (x = 0; x < pixelSquare; x++) { \
+				for (y = 0; y < pixelSquare; y++) { \
+					/* Calculate the exact pixel position we want to get */ \
+					int xIndex = i + x - BLUR_LEVEL; \
+					int yIndex = j + y - BLUR_LEVEL; \
+ \
+					/* If pixel position is outside of our matrix then let's go to the next pixel */ \
+					if (xIndex < 0 || xIndex >= img->x || yIndex < 0 || yIndex >= img->y) \
+						continue; \
+ \
+					/* Sum the value in a total by color */ \
+					pixel = (Sample *)imageSamples(img, yIndex) + CHANNELS * xIndex; \
+					for (c = 0; c < CHANNELS; c++) \
+						total[c] += pixel[c]; \
+				} \
+			} \
+ \
+			/* Time to find the average dividing each color result by the total of pixels */ \
+			for (c = 0; c < CHANNELS; c++) \
+				average[c] = (Sample)(total[c] / pixelLenght); \
+ \
+			/* Now we do everything again, but now we fill the colors with the average value */ \
+			for (x = 0; x < pixelSquare; x++) { \
+				for (y = 0; y < pixelSquare; y++) { \
+					int xIndex = i + x - BLUR_LEVEL; \
+					int yIndex = j + y - BLUR_LEVEL; \
+					if (xIndex < 0 || xIndex >= img->x || yIndex < 0 || yIndex >= img->y) \
+						continue; \
+ \
+					/* Assign the color average value to the pixel */ \
+					pixel = (Sample *)imageSamples(img, yIndex) + CHANNELS * xIndex; \
+					for (c = 0; c < CHANNELS; c++) \
+						pixel[c] = average[c]; \
+				} \
+			} \
+		} \
+	} \
+}
+
+DEFINE_BLUR_COLUMNS(blurColumns, unsigned char, int, 3)
+DEFINE_BLUR_COLUMNS(blurColumns16, unsigned short, long long, 3)
+DEFINE_BLUR_COLUMNS(blurColumnsGray, unsigned char, int, 1)
+DEFINE_BLUR_COLUMNS(blurColumnsGray16, unsigned short, long long, 1)
+
+static void threadMeanBlur(void *arg, int iThread, int numThreads){
+	Image *img = (Image *)arg;
+	int startX = 0, endX = 0;
+
+	if (img){
+		// the strips take the remainder columns as well
+		startX = (int)((long long)img->x * iThread / numThreads);
+		endX = (int)((long long)img->x * (iThread + 1) / numThreads);
+
+		// grayscale images use the single channel kernels
+		if (img->channels == 3)
+			(img->depth == 1 ? blurColumns : blurColumns16)(img, startX, endX);
+		else
+			(img->depth == 1 ? blurColumnsGray : blurColumnsGray16)(img, startX, endX);
+	}
+}
+
+void filterMeanBlurInPlace(Image *img)
+{
+	parallelRun(threadMeanBlur, img);
+}
+
+// Means of the pixels i0 to i1 - 1 of a row from the column sums of its window rows, each window
+// summed on its own and cut at the borders
+static void meanRowBorder(const unsigned int *sums, int x, int rows, int channels, int radius, int i0, int i1,
+	int depth, unsigned char *out)
+{
+	int i, k, c, x0, x1, count;
+	unsigned int total;
+
+	for (i = i0; i < i1; i++) {
+		x0 = i - radius < 0 ? 0 : i - radius;
+		x1 = i + radius >= x ? x - 1 : i + radius;
+		count = (x1 - x0 + 1) * rows;
+		for (c = 0; c < channels; c++) {
+			total = 0;
+			for (k = x0; k <= x1; k++)
+				total += sums[channels * k + c];
+			if (depth == 1)
+				out[channels * i + c] = (unsigned char)(total / count);
+			else
+				((unsigned short *)out)[channels * i + c] = (unsigned short)(total / count);
+		}
+	}
+}
+
+// Means of a row for any radius and number of channels: the window slides along the row,
+// so each pixel costs a constant number of additions
+static void meanRowGeneric(const unsigned int *sums, int x, int rows, int channels, int radius, int depth,
+	unsigned char *out)
+{
+	int i, c, x0, x1, count;
+	unsigned int total[3];
+
+	// first window of the row
+	for (c = 0; c < channels; c++)
+		total[c] = 0;
+	x1 = radius >= x ? x - 1 : radius;
+	for (i = 0; i <= x1; i++)
+		for (c = 0; c < channels; c++)
+			total[c] += sums[channels * i + c];
+
+	for (i = 0; i < x; i++) {
+		x0 = i - radius < 0 ? 0 : i - radius;
+		x1 = i + radius >= x ? x - 1 : i + radius;
+
+		// average of the pixels of the window that are inside the image
+		count = (x1 - x0 + 1) * rows;
+		if (depth == 1)
+			for (c = 0; c < channels; c++)
+				out[channels * i + c] = (unsigned char)(total[c] / count);
+		else
+			for (c = 0; c < channels; c++)
+				((unsigned short *)out)[channels * i + c] = (unsigned short)(total[c] / count);
+
+		// slide the window to the next pixel
+		if (i - radius >= 0)
+			for (c = 0; c < channels; c++)
+				total[c] -= sums[channels * (i - radius) + c];
+		if (i + radius + 1 < x)
+			for (c = 0; c < channels; c++)
+				total[c] += sums[channels * (i + radius + 1) + c];
+	}
+}
+
+// Multiplier and shift that divide any total below 1 << MEAN_TOTAL_BITS by count exactly,
+// as total * multiplier >> shift: the rounding error of the multiplier stays below 1 / count.
+static void meanReciprocal(unsigned int count, unsigned int *multiplier, int *shift)
+{
+	int bits = 0;
+
+	while ((1u << bits) < count)
+		bits++;
+	*shift = MEAN_TOTAL_BITS + bits;
+	*multiplier = (unsigned int)(((1ULL << *shift) + count - 1) / count);
+}
+
+// Means of a row for a radius and a number of channels known at compile time. The pixels whose
+// window is inside the row all divide by the same count, so their loop has no bounds to check:
+// the totals of the channels slide with constant offsets, the channel loop is unrolled by the
+// compiler and the division is a multiplication. The few pixels near the borders are done on their own.
+#define DEFINE_MEAN_ROW(name, RADIUS, CHANNELS) \
+static void name(const unsigned int *sums, int x, int rows, int depth, unsigned char *out) \
+{ \
+	size_t s, end; \
+	unsigned int total[CHANNELS], multiplier; \
+	int k, c, shift; \
+ \
+	if (x <= 2 * RADIUS) { \
+		meanRowBorder(sums, x, rows, CHANNELS, RADIUS, 0, x, depth, out); \
+		return; \
+	} \
+	meanRowBorder(sums, x, rows, CHANNELS, RADIUS, 0, RADIUS, depth, out); \
+	meanRowBorder(sums, x, rows, CHANNELS, RADIUS, x - RADIUS, x, depth, out); \
+ \
+	/* the totals hold the window of the first inner pixel but its last column */ \
+	for (c = 0; c < CHANNELS; c++) { \
+		total[c] = 0; \
+		for (k = 0; k < 2 * RADIUS; k++) \
+			total[c] += sums[CHANNELS * k + c]; \
+	} \
+ \
+	meanReciprocal((2 * RADIUS + 1) * rows, &multiplier, &shift); \
+	end = (size_t)(x - RADIUS) * CHANNELS; \
+	if (depth == 1) { \
+		for (s = RADIUS * CHANNELS; s < end; s += CHANNELS) { \
+			for (c = 0; c < CHANNELS; c++) { \
+				total[c] += sums[s + CHANNELS * RADIUS + c]; \
+				out[s + c] = (unsigned char)((unsigned long long)total[c] * multiplier >> shift); \
+				total[c] -= sums[s - CHANNELS * RADIUS + c]; \
+			} \
+		} \
+	} \
+	else { \
+		for (s = RADIUS * CHANNELS; s < end; s += CHANNELS) { \
+			for (c = 0; c < CHANNELS; c++) { \
+				total[c] += sums[s + CHANNELS * RADIUS + c]; \
+				((unsigned short *)out)[s + c] = (unsigned short)((unsigned long long)total[c] * multiplier >> shift); \
+				total[c] -= sums[s - CHANNELS * RADIUS + c]; \
+			} \
+		} \
+	} \
+}
+
+DEFINE_MEAN_ROW(meanRow1, 1, 3)
+DEFINE_MEAN_ROW(meanRow2, 2, 3)
+DEFINE_MEAN_ROW(meanRow3, 3, 3)
+DEFINE_MEAN_ROW(meanRow4, 4, 3)
+DEFINE_MEAN_ROW(meanRow5, 5, 3)
+DEFINE_MEAN_ROW(meanRow6, 6, 3)
+DEFINE_MEAN_ROW(meanRow7, 7, 3)
+DEFINE_MEAN_ROW(meanRow8, 8, 3)
+DEFINE_MEAN_ROW(meanRowGray1, 1, 1)
+DEFINE_MEAN_ROW(meanRowGray2, 2, 1)
+DEFINE_MEAN_ROW(meanRowGray3, 3, 1)
+DEFINE_MEAN_ROW(meanRowGray4, 4, 1)
+DEFINE_MEAN_ROW(meanRowGray5, 5, 1)
+DEFINE_MEAN_ROW(meanRowGray6, 6, 1)
+DEFINE_MEAN_ROW(meanRowGray7, 7, 1)
+DEFINE_MEAN_ROW(meanRowGray8, 8, 1)
+
+typedef void (*MeanRowKernel)(const unsigned int *sums, int x, int rows, int depth, unsigned char *out);
+
+// Specialized row kernels by radius - 1, for grayscale then RGB images
+static const MeanRowKernel meanRowKernels[MEAN_SPECIALIZED_RADIUS][2] = {
+	{ meanRowGray1, meanRow1 }, { meanRowGray2, meanRow2 }, { meanRowGray3, meanRow3 }, { meanRowGray4, meanRow4 },
+	{ meanRowGray5, meanRow5 }, { meanRowGray6, meanRow6 }, { meanRowGray7, meanRow7 }, { meanRowGray8, meanRow8 },
+};
+
+// The columns of the window are summed first, then the row kernel averages the column sums.
+// Sums of 16-bits components fit in 32 bits for any radius up to MEAN_MAX_RADIUS.
+void meanBlurRow(const unsigned char *ring, int ringRows, size_t rowSize, int x, int y,
+	int channels, int depth, int radius, int j, unsigned int *sums, unsigned char *out)
+{
+	int i, k, y0, y1, samples = x * channels;
+	const unsigned char *row;
+
+	// window rows, limited to the image
+	y0 = j - radius < 0 ? 0 : j - radius;
+	y1 = j + radius >= y ? y - 1 : j + radius;
+
+	// sum every column of the window
+	for (k = 0; k < samples; k++)
+		sums[k] = 0;
+	for (i = y0; i <= y1; i++) {
+		row = ring + (size_t)(i % ringRows) * rowSize;
+		if (depth == 1)
+			for (k = 0; k < samples; k++)
+				sums[k] += row[k];
+		else
+			for (k = 0; k < samples; k++)
+				sums[k] += ((const unsigned short *)row)[k];
+	}
+
+	// the common radii have their own kernels, the others slide a generic window
+	if (radius >= 1 && radius <= MEAN_SPECIALIZED_RADIUS)
+		meanRowKernels[radius - 1][channels == 3](sums, x, y1 - y0 + 1, depth, out);
+	else
+		meanRowGeneric(sums, x, y1 - y0 + 1, channels, radius, depth, out);
+}
+
+// Structure for a pass of the double-buffered mean blur
+typedef struct {
+	const Image *img;
+	const Image *src;
+	Image *dst;
+	int radius;
+} MeanBlurTask;
+
+// Each thread writes whole rows, so threads only meet on the cache line between two strips
+static void threadMeanBlurRows(void *arg, int index, int count)
+{
+	MeanBlurTask *task = (MeanBlurTask *)arg;
+	const Image *img = task->img;
+	int j, startY = (int)((long long)img->y * index / count), endY = (int)((long long)img->y * (index + 1) / count);
+	unsigned int *sums;
+
+	sums = (unsigned int *)malloc(imageRowSamples(img) * sizeof(unsigned int));
+	if (!sums) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	// the whole source image is the ring, so slot j is row j
+	for (j = startY; j < endY; j++)
+		meanBlurRow(task->src->data, img->y, task->src->stride, img->x, img->y, img->channels, img->depth, task->radius,
+			j, sums, imageSamples(task->dst, j));
+
+	free(sums);
+}
+
+void filterMeanBlurPasses(Image *img, int radius, int passes)
+{
+	MeanBlurTask task;
+	Image *other, *buffers[2];
+	int p, first;
+
+	if (!img || radius <= 0 || passes <= 0)
+		return;
+
+	// the second buffer pads its rows when img does, a view keeps the stride of its owner
+	other = createImage(img->x, img->y, img->channels, img->maxval, img->stride != imageRowSize(img));
+	if (!other) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	// the passes go back and forth between the two buffers, the first one is picked so the
+	// last pass writes img. With an odd number of passes the first one reads a copy of img.
+	buffers[0] = img;
+	buffers[1] = other;
+	first = passes % 2;
+	if (first)
+		copyImageRect(other, 0, 0, img, 0, 0, img->x, img->y);
+
+	task.img = img;
+	task.radius = radius < MEAN_MAX_RADIUS ? radius : MEAN_MAX_RADIUS;
+	for (p = 0; p < passes; p++) {
+		task.src = buffers[(p + first) % 2];
+		task.dst = buffers[(p + first + 1) % 2];
+		parallelRun(threadMeanBlurRows, &task);
+	}
+
+	freeImage(other);
+}
+
+static double gaussianSigma = BLUR_SIGMA;
+static int blurLevel = BLUR_LEVEL;
+
+void filterMeanBlur(Image *img)
+{
+	filterMeanBlurPasses(img, blurLevel, 1);
+}
+
+double blurSigma(void)
+{
+	return gaussianSigma;
+}
+
+void setBlurSigma(double sigma)
+{
+	gaussianSigma = sigma;
+}
+
+int blurRadius(void)
+{
+	return blurLevel;
+}
+
+void setBlurRadius(int radius)
+{
+	blurLevel = radius;
+}
+
+// Structure for the tiles of a Gaussian blur
+typedef struct {
+	Image *img;
+	const Image *src; // Copy of img, the tiles read the pixels around them after their neighbours wrote theirs
+	const unsigned int *weights; // 2 * radius + 1 weights of 16 fraction bits, their sum is 1 << 16
+	int radius;
+	int tileWidth, tileHeight;
+	unsigned short *tmp; // Horizontal pass of a tile and the rows around it for every worker, 8 more fraction bits for 8-bits components
+	unsigned int *total; // A row of totals for every worker
+} GaussianTask;
+
+// Horizontal pass of the pixels x0 to x1 - 1 of a row that are near its borders, whose window
+// goes past them. Pixels past the borders repeat the border pixel. total starts at pixel x0.
+#define DEFINE_GAUSSIAN_BORDERS(name, Sample, CHANNELS) \
+static void name(const Sample *src, unsigned int *total, int x, int x0, int x1, const unsigned int *weights, int radius) \
+{ \
+	int i, k, c, index; \
+	int lo = x0 > radius ? x0 : radius, hi = x1 < x - radius ? x1 : x - radius; \
+ \
+	for (i = x0; i < x1; i++) { \
+		/* the pixels in between have their window inside the row */ \
+		if (i == lo && hi > lo) { \
+			i = hi - 1; \
+			continue; \
+		} \
+		for (k = 0; k <= 2 * radius; k++) { \
+			index = i + k - radius; \
+			index = index < 0 ? 0 : index >= x ? x - 1 : index; \
+			for (c = 0; c < CHANNELS; c++) \
+				total[CHANNELS * (i - x0) + c] += weights[k] * src[CHANNELS * index + c]; \
+		} \
+	} \
+}
+
+DEFINE_GAUSSIAN_BORDERS(gaussianBorders, unsigned char, 3)
+DEFINE_GAUSSIAN_BORDERS(gaussianBorders16, unsigned short, 3)
+DEFINE_GAUSSIAN_BORDERS(gaussianBordersGray, unsigned char, 1)
+DEFINE_GAUSSIAN_BORDERS(gaussianBordersGray16, unsigned short, 1)
+
+// Both passes over a tile. The horizontal pass covers the tile and radius rows above and below it,
+// which stay in the cache for the vertical pass, so the image is read and written once.
+// Inside the row, the samples a weight applies to are a flat run shifted by a whole number of
+// pixels, so each weight is applied to the whole run at once by the kernels. The vertical pass
+// accumulates whole tile rows the same way.
+static void tileGaussian(void *arg, const Tile *tile, int worker)
+{
+	GaussianTask *task = (GaussianTask *)arg;
+	Image *img = task->img;
+	const Image *src = task->src;
+	const SimdKernels *kernels = simdKernels();
+	int channels = img->channels, radius = task->radius;
+	size_t samples = (size_t)(tile->x1 - tile->x0) * channels, tileSamples = (size_t)task->tileWidth * channels;
+	unsigned short *tmp = task->tmp + tileSamples * (task->tileHeight + 2 * radius) * worker;
+	unsigned int *total = task->total + tileSamples * worker;
+	int j, k, row, lo, hi;
+	int startY = tile->y0 > radius ? tile->y0 - radius : 0, endY = tile->y1 + radius < img->y ? tile->y1 + radius : img->y;
+
+	// columns whose window is inside the row
+	lo = tile->x0 > radius ? tile->x0 : radius;
+	hi = tile->x1 < img->x - radius ? tile->x1 : img->x - radius;
+
+	// rows past the borders repeat the border rows, so only the rows inside the image are computed
+	for (j = startY; j < endY; j++) {
+		memset(total, 0, samples * sizeof(unsigned int));
+		for (k = 0; k <= 2 * radius && hi > lo; k++) {
+			if (img->depth == 1)
+				kernels->accumulate8(total + channels * (lo - tile->x0), imageSamples(src, j) + channels * (lo - radius + k),
+					(size_t)(hi - lo) * channels, task->weights[k]);
+			else
+				kernels->accumulate(total + channels * (lo - tile->x0), imageSamples16(src, j) + channels * (lo - radius + k),
+					(size_t)(hi - lo) * channels, task->weights[k]);
+		}
+
+		if (channels == 3)
+			(img->depth == 1 ? gaussianBorders(imageSamples(src, j), total, img->x, tile->x0, tile->x1, task->weights, radius) :
+				gaussianBorders16(imageSamples16(src, j), total, img->x, tile->x0, tile->x1, task->weights, radius));
+		else
+			(img->depth == 1 ? gaussianBordersGray(imageSamples(src, j), total, img->x, tile->x0, tile->x1, task->weights, radius) :
+				gaussianBordersGray16(imageSamples16(src, j), total, img->x, tile->x0, tile->x1, task->weights, radius));
+
+		// 8-bits components keep 8 fraction bits for the vertical pass
+		kernels->narrow16(tmp + samples * (j - startY), total, samples, img->depth == 1 ? 8 : 16);
+	}
+
+	for (j = tile->y0; j < tile->y1; j++) {
+		memset(total, 0, samples * sizeof(unsigned int));
+		for (k = 0; k <= 2 * radius; k++) {
+			row = j + k - radius;
+			row = row < 0 ? 0 : row >= img->y ? img->y - 1 : row;
+			kernels->accumulate(total, tmp + samples * (row - startY), samples, task->weights[k]);
+		}
+
+		// 8-bits components drop the 8 fraction bits of the horizontal pass as well
+		if (img->depth == 1)
+			kernels->narrow(imageSamples(img, j) + channels * tile->x0, total, samples, 24);
+		else
+			kernels->narrow16(imageSamples16(img, j) + channels * tile->x0, total, samples, 16);
+	}
+}
+
+void filterGaussianBlurSigma(Image *img, double sigma)
+{
+	GaussianTask task;
+	Image *src;
+	unsigned int *weights;
+	double sum = 0, partial = 0;
+	size_t tileSamples;
+	int k, radius, previous = 0, next, workers;
+
+	if (!img || sigma <= 0)
+		return;
+
+	// 3 sigma hold 99.7% of the curve, the weights beyond are rounded to 0 anyway
+	radius = (int)ceil(3 * sigma);
+	weights = (unsigned int *)malloc((2 * radius + 1) * sizeof(unsigned int));
+	if (!weights) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	// the weights are the steps of the rounded running sum, so they are never negative
+	// and always add up to exactly 1 << 16 whatever the sigma
+	for (k = -radius; k <= radius; k++)
+		sum += exp(-(double)k * k / (2 * sigma * sigma));
+	for (k = -radius; k <= radius; k++) {
+		partial += exp(-(double)k * k / (2 * sigma * sigma));
+		next = (int)floor(partial / sum * 65536 + 0.5);
+		weights[k + radius] = (unsigned int)(next - previous);
+		previous = next;
+	}
+
+	// the tiles overwrite pixels the tiles around them still have to read
+	src = createImage(img->x, img->y, img->channels, img->maxval, img->stride != imageRowSize(img));
+	if (!src) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+	copyImageRect(src, 0, 0, img, 0, 0, img->x, img->y);
+
+	task.img = img;
+	task.src = src;
+	task.weights = weights;
+	task.radius = radius;
+	tileSize(img, radius, (size_t)img->channels * (img->depth + sizeof(unsigned short)), &task.tileWidth, &task.tileHeight);
+	workers = parallelThreads();
+	tileSamples = (size_t)task.tileWidth * img->channels;
+	task.tmp = (unsigned short *)malloc(tileSamples * (task.tileHeight + 2 * radius) * workers * sizeof(unsigned short));
+	task.total = (unsigned int *)malloc(tileSamples * workers * sizeof(unsigned int));
+	if (!task.tmp || !task.total) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	tileRun(img, task.tileWidth, task.tileHeight, tileGaussian, &task);
+
+	free(task.total);
+	free(task.tmp);
+	freeImage(src);
+	free(weights);
+}
+
+void filterGaussianBlur(Image *img)
+{
+	filterGaussianBlurSigma(img, gaussianSigma);
+}
+
+// Structure for the passes of a box blur
+typedef struct {
+	Image *img;
+	unsigned short *tmp; // Image after the horizontal pass, 8 more fraction bits for 8-bits components
+	int radius;
+} BoxTask;
+
+// Horizontal pass of a row: a running total of the window gets the pixel entering it and loses
+// the pixel leaving it, so the cost doesn't depend on the radius. Pixels past the borders repeat
+// the border pixel. SHIFT adds the fraction bits the output keeps.
+#define DEFINE_BOX_ROW(name, Sample, CHANNELS, SHIFT) \
+static void name(const Sample *src, unsigned short *dst, int x, int radius) \
+{ \
+	int i, k, c, in, out; \
+	unsigned int total[CHANNELS], size = 2 * radius + 1; \
+ \
+	/* window of the first pixel */ \
+	for (c = 0; c < CHANNELS; c++) \
+		total[c] = (unsigned int)(radius + 1) * src[c]; \
+	for (k = 1; k <= radius && k < x; k++) \
+		for (c = 0; c < CHANNELS; c++) \
+			total[c] += src[CHANNELS * k + c]; \
+	for (c = 0; c < CHANNELS; c++) \
+		total[c] += (unsigned int)(radius + 1 - k) * src[CHANNELS * (x - 1) + c]; \
+ \
+	for (i = 0; i < x; i++) { \
+		for (c = 0; c < CHANNELS; c++) \
+			dst[CHANNELS * i + c] = (unsigned short)(((total[c] << SHIFT) + size / 2) / size); \
+		in = i + radius + 1 < x ? i + radius + 1 : x - 1; \
+		out = i - radius > 0 ? i - radius : 0; \
+		for (c = 0; c < CHANNELS; c++) \
+			total[c] += src[CHANNELS * in + c] - src[CHANNELS * out + c]; \
+	} \
+}
+
+DEFINE_BOX_ROW(boxRow, unsigned char, 3, 8)
+DEFINE_BOX_ROW(boxRow16, unsigned short, 3, 0)
+DEFINE_BOX_ROW(boxRowGray, unsigned char, 1, 8)
+DEFINE_BOX_ROW(boxRowGray16, unsigned short, 1, 0)
+
+static void threadBoxRows(void *arg, int index, int count)
+{
+	BoxTask *task = (BoxTask *)arg;
+	Image *img = task->img;
+	size_t rowSamples = imageRowSamples(img);
+	int j, startY = (int)((long long)img->y * index / count), endY = (int)((long long)img->y * (index + 1) / count);
+
+	for (j = startY; j < endY; j++) {
+		if (img->channels == 3) {
+			if (img->depth == 1)
+				boxRow(imageSamples(img, j), task->tmp + rowSamples * j, img->x, task->radius);
+			else
+				boxRow16(imageSamples16(img, j), task->tmp + rowSamples * j, img->x, task->radius);
+		}
+		else {
+			if (img->depth == 1)
+				boxRowGray(imageSamples(img, j), task->tmp + rowSamples * j, img->x, task->radius);
+			else
+				boxRowGray16(imageSamples16(img, j), task->tmp + rowSamples * j, img->x, task->radius);
+		}
+	}
+}
+
+// Vertical pass, the totals of every column slide down the rows of the thread the same way
+static void threadBoxColumns(void *arg, int index, int count)
+{
+	BoxTask *task = (BoxTask *)arg;
+	Image *img = task->img;
+	const SimdKernels *kernels = simdKernels();
+	size_t rowSamples = imageRowSamples(img), i;
+	int j, k, row, startY = (int)((long long)img->y * index / count), endY = (int)((long long)img->y * (index + 1) / count);
+	unsigned int *total, size = (2 * task->radius + 1) * (img->depth == 1 ? 256 : 1);
+	const unsigned short *in, *out;
+	unsigned char *dst;
+	unsigned short *dst16;
+
+	if (startY >= endY)
+		return;
+
+	total = (unsigned int *)calloc(rowSamples, sizeof(unsigned int));
+	if (!total) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	// window of the first row of the thread
+	for (k = -task->radius; k <= task->radius; k++) {
+		row = startY + k;
+		row = row < 0 ? 0 : row >= img->y ? img->y - 1 : row;
+		kernels->accumulate(total, task->tmp + rowSamples * row, rowSamples, 1);
+	}
+
+	for (j = startY; j < endY; j++) {
+		if (img->depth == 1) {
+			dst = imageSamples(img, j);
+			for (i = 0; i < rowSamples; i++)
+				dst[i] = (unsigned char)((total[i] + size / 2) / size);
+		}
+		else {
+			dst16 = imageSamples16(img, j);
+			for (i = 0; i < rowSamples; i++)
+				dst16[i] = (unsigned short)((total[i] + size / 2) / size);
+		}
+
+		row = j + task->radius + 1 < img->y ? j + task->radius + 1 : img->y - 1;
+		in = task->tmp + rowSamples * row;
+		row = j - task->radius > 0 ? j - task->radius : 0;
+		out = task->tmp + rowSamples * row;
+		kernels->slide(total, in, out, rowSamples);
+	}
+
+	free(total);
+}
+
+// Run box blurs of the given radii one after the other
+static void boxBlurPasses(Image *img, const int *radii, int passes)
+{
+	BoxTask task;
+	int p;
+
+	task.img = img;
+	task.tmp = (unsigned short *)malloc(imageRowSamples(img) * img->y * sizeof(unsigned short));
+	if (!task.tmp) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	for (p = 0; p < passes; p++) {
+		// the totals of a column hold 2 * radius + 1 values of 16 bits
+		task.radius = radii[p] < BOX_MAX_RADIUS ? radii[p] : BOX_MAX_RADIUS;
+		if (task.radius <= 0)
+			continue;
+		parallelRun(threadBoxRows, &task);
+		parallelRun(threadBoxColumns, &task);
+	}
+
+	free(task.tmp);
+}
+
+void filterBoxBlurRadius(Image *img, int radius)
+{
+	if (img)
+		boxBlurPasses(img, &radius, 1);
+}
+
+void filterBoxBlur(Image *img)
+{
+	filterBoxBlurRadius(img, blurLevel);
+}
+
+void filterFastGaussianBlurSigma(Image *img, double sigma)
+{
+	int radii[BOX_PASSES], p, lower, larger;
+	double ideal;
+
+	if (!img || sigma <= 0)
+		return;
+
+	// a box of width w has a variance of (w * w - 1) / 12 and variances add up over the passes.
+	// The passes use the two odd widths around the ideal one, as many of each as gets closest
+	// to sigma * sigma.
+	ideal = sqrt(12 * sigma * sigma / BOX_PASSES + 1);
+	lower = (int)floor(ideal);
+	if (lower % 2 == 0)
+		lower--;
+	larger = (int)floor((12 * sigma * sigma - BOX_PASSES * lower * lower - 4.0 * BOX_PASSES * lower - 3 * BOX_PASSES) /
+		(-4.0 * lower - 4) + 0.5);
+	for (p = 0; p < BOX_PASSES; p++)
+		radii[p] = (p < larger ? lower : lower + 2) / 2;
+
+	boxBlurPasses(img, radii, BOX_PASSES);
+}
+
+void filterFastGaussianBlur(Image *img)
+{
+	filterFastGaussianBlurSigma(img, gaussianSigma);
+}
+
+// Structure for a box blur of varying radius
+typedef struct {
+	Image *img;
+	const IntegralImage *table;
+	const int *radii;
+} VaryingBoxTask;
+
+static void threadBoxBlurVarying(void *arg, int index, int count)
+{
+	VaryingBoxTask *task = (VaryingBoxTask *)arg;
+	Image *img = task->img;
+	const IntegralImage *table = task->table;
+	int i, j, c, radius, x0, y0, x1, y1, startY = (int)((long long)img->y * index / count), endY = (int)((long long)img->y * (index + 1) / count);
+	unsigned long long area;
+	unsigned char *row;
+	unsigned short *row16;
+
+	for (j = startY; j < endY; j++) {
+		row = imageSamples(img, j);
+		row16 = imageSamples16(img, j);
+		for (i = 0; i < img->x; i++) {
+			// the window is cut at the borders, it averages the pixels inside the image
+			radius = task->radii[(size_t)img->x * j + i];
+			x0 = i - radius > 0 ? i - radius : 0;
+			y0 = j - radius > 0 ? j - radius : 0;
+			x1 = i + radius + 1 < img->x ? i + radius + 1 : img->x;
+			y1 = j + radius + 1 < img->y ? j + radius + 1 : img->y;
+			area = (unsigned long long)(x1 - x0) * (y1 - y0);
+
+			for (c = 0; c < img->channels; c++) {
+				if (img->depth == 1)
+					row[img->channels * i + c] = (unsigned char)((integralSum(table, x0, y0, x1, y1, c) + area / 2) / area);
+				else
+					row16[img->channels * i + c] = (unsigned short)((integralSum(table, x0, y0, x1, y1, c) + area / 2) / area);
+			}
+		}
+	}
+}
+
+void filterBoxBlurVarying(Image *img, const int *radii)
+{
+	VaryingBoxTask task;
+	IntegralImage *table;
+
+	if (!img)
+		return;
+
+	// the sums come from the table, so the pixels can be written in place
+	table = createIntegralImage(img, 0);
+	task.img = img;
+	task.table = table;
+	task.radii = radii;
+	parallelRun(threadBoxBlurVarying, &task);
+	freeIntegralImage(table);
+}
+
+FilterFunction findFilter(const char *name)
+{
+	if (strcmp(name, "blur") == 0)
+		return filterGaussianBlur;
+	if (strcmp(name, "fastblur") == 0)
+		return filterFastGaussianBlur;
+	if (strcmp(name, "box") == 0)
+		return filterBoxBlur;
+	if (strcmp(name, "mean") == 0)
+		return filterMeanBlur;
+	if (strcmp(name, "median") == 0)
+		return filterMedian;
+	if (strcmp(name, "invert") == 0)
+		return filterChangeColor;
+	return NULL;
+}
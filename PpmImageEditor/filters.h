@@ -0,0 +1,71 @@
+#ifndef FILTERS_H
+#define FILTERS_H
+
+#include "image.h"
+
+#define BLUR_LEVEL 2 // Default radius of the mean, box and median filters, see setBlurRadius()
+#define BLUR_SIGMA 1.0 // Default standard deviation of the Gaussian blur, see setBlurSigma()
+#define BOX_PASSES 3 // Box blurs making up the fast Gaussian blur
+#define BOX_MAX_RADIUS 32767 // Largest box blur radius, the running totals hold 2 * radius + 1 values
+#define MEAN_MAX_RADIUS 127 // Largest mean blur radius, the column sums hold 2 * radius + 1 values of 16 bits
+
+// Filter applied to a whole image
+typedef void (*FilterFunction)(Image *img);
+
+void filterChangeColor(Image *img);
+
+// Average of the pixels of the (2 * radius + 1)^2 window around each pixel that are inside
+// the image. Every pass reads one buffer and writes the other, so the result doesn't depend on
+// the threads. Radii 1 to 8 have row kernels specialized for them. filterMeanBlur() runs a single
+// pass of the radius given to setBlurRadius().
+void filterMeanBlurPasses(Image *img, int radius, int passes);
+void filterMeanBlur(Image *img);
+
+// The first blur of the editor: the average of each window is written back over the whole window,
+// in place, by threads working on neighbouring columns. The result depends on their scheduling.
+void filterMeanBlurInPlace(Image *img);
+
+// Mean blur of row j from rows held in a ring buffer, row r being stored at slot r % ringRows
+// with rowSize bytes per slot. sums holds x * channels values.
+void meanBlurRow(const unsigned char *ring, int ringRows, size_t rowSize, int x, int y,
+	int channels, int depth, int radius, int j, unsigned int *sums, unsigned char *out);
+
+// Gaussian blur of standard deviation sigma, as a horizontal then a vertical pass with
+// 2 * ceil(3 * sigma) + 1 fixed-point weights, so it costs O(sigma) per pixel.
+// filterGaussianBlur() uses the sigma given to setBlurSigma(), BLUR_SIGMA by default.
+void filterGaussianBlurSigma(Image *img, double sigma);
+void filterGaussianBlur(Image *img);
+double blurSigma(void);
+void setBlurSigma(double sigma);
+
+// Radius of the mean, box and median filters, BLUR_LEVEL by default
+int blurRadius(void);
+void setBlurRadius(int radius);
+
+// Average of the (2 * radius + 1)^2 pixels around each pixel, computed with running totals that
+// slide along the rows then down the columns, so the cost per pixel doesn't depend on the radius.
+// Pixels past the borders repeat the border pixels. filterBoxBlur() uses the radius given to setBlurRadius().
+void filterBoxBlurRadius(Image *img, int radius);
+void filterBoxBlur(Image *img);
+
+// Box blur with a radius per pixel, radii holds the x * y radii (0 or more) row after row.
+// Windows are cut at the borders. Every pixel takes 4 lookups in a summed-area table of the image,
+// so the cost doesn't depend on the radii.
+void filterBoxBlurVarying(Image *img, const int *radii);
+
+// Approximation of the Gaussian blur by BOX_PASSES box blurs, in constant time per pixel whatever
+// sigma. filterFastGaussianBlur() uses the sigma given to setBlurSigma().
+void filterFastGaussianBlurSigma(Image *img, double sigma);
+void filterFastGaussianBlur(Image *img);
+
+// Median of the (2 * radius + 1)^2 pixels around each pixel, for each channel, which removes
+// salt and pepper noise and keeps the edges. Pixels past the borders repeat the border pixels.
+// Radii 1 and 2 run sorting networks, larger ones keep histograms of the window so 8-bits
+// images cost the same per pixel whatever the radius. filterMedian() uses the radius given to setBlurRadius().
+void filterMedianRadius(Image *img, int radius);
+void filterMedian(Image *img);
+
+// Filter of the given name ("blur", "fastblur", "box", "mean", "median" or "invert"), NULL when there is none
+FilterFunction findFilter(const char *name);
+
+#endif
@@ -0,0 +1,640 @@
+#include "platform.h"
+#include "image.h"
+#include "ascii.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+
+#define WRITE_BUFFER (1 << 20) // Bytes of 16-bits pixels converted at once when writing
+
+// Gray values of the 8 pixels of every bitmap byte, bits set to 1 are black (0)
+static unsigned char bitmapValues[256][8];
+static pthread_once_t bitmapOnce = PTHREAD_ONCE_INIT; // The batch reads files on many threads
+
+// Bytes before the pixels of an allocated image, the structure rounded up to the alignment
+#define IMAGE_HEADER_SLOT ((sizeof(Image) + IMAGE_ALIGNMENT - 1) / IMAGE_ALIGNMENT * IMAGE_ALIGNMENT)
+
+Image *createImage(int x, int y, int channels, int maxval, int padRows)
+{
+	Image *img;
+	size_t stride;
+	void *block;
+	int depth = maxval > RGB_TOTAL_COLORS ? 2 : 1;
+
+	if (x <= 0 || y <= 0 || maxval <= 0 || maxval > RGB_TOTAL_COLORS_16 || (channels != 1 && channels != 3))
+		return NULL;
+
+	if ((size_t)x > (size_t)-1 / channels / depth)
+		return NULL;
+
+	stride = (size_t)x * channels * depth;
+	if (padRows)
+		stride = (stride + IMAGE_ALIGNMENT - 1) / IMAGE_ALIGNMENT * IMAGE_ALIGNMENT;
+
+	if (stride > ((size_t)-1 - IMAGE_HEADER_SLOT) / (size_t)y)
+		return NULL;
+
+	// the image structure takes the first aligned slots, the pixels start right after it
+	block = alignedAlloc(IMAGE_HEADER_SLOT + stride * y, IMAGE_ALIGNMENT);
+	if (!block)
+		return NULL;
+
+	img = (Image *)block;
+	img->x = x;
+	img->y = y;
+	img->channels = channels;
+	img->maxval = maxval;
+	img->depth = depth;
+	img->stride = stride;
+	img->data = (unsigned char *)block + IMAGE_HEADER_SLOT;
+	img->map = NULL;
+	img->mapSize = 0;
+	img->parent = NULL;
+	img->references = 1;
+	img->format = 0;
+	return img;
+}
+
+Image *createImageView(Image *img, int x0, int y0, int width, int height)
+{
+	Image *view;
+
+	if (!img || x0 < 0 || y0 < 0 || width <= 0 || height <= 0 || width > img->x - x0 || height > img->y - y0)
+		return NULL;
+
+	view = (Image *)alignedAlloc(sizeof(Image), IMAGE_ALIGNMENT);
+	if (!view)
+		return NULL;
+
+	view->x = width;
+	view->y = height;
+	view->channels = img->channels;
+	view->maxval = img->maxval;
+	view->depth = img->depth;
+	view->stride = img->stride;
+	view->data = imageSamples(img, y0) + (size_t)x0 * img->channels * img->depth;
+	view->map = NULL;
+	view->mapSize = 0;
+	view->parent = img->parent ? img->parent : img;
+	view->references = 0;
+	view->format = img->format;
+	atomicAdd(&view->parent->references, 1);
+	return view;
+}
+
+void copyImageRect(Image *dst, int dx, int dy, const Image *src, int sx, int sy, int width, int height)
+{
+	size_t pixelSize = (size_t)src->channels * src->depth;
+	int j;
+
+	for (j = 0; j < height; j++)
+		memcpy(imageSamples(dst, dy + j) + dx * pixelSize, imageSamples(src, sy + j) + sx * pixelSize, width * pixelSize);
+}
+
+// Read a decimal number of a PPM header, skipping whitespaces and comments before it.
+// Returns -1 when there is no number.
+static int readHeaderValue(FILE *fp)
+{
+	int c, value = -1;
+
+	c = getc(fp);
+	while (c == '#' || c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+		//check for comments
+		if (c == '#')
+			while (c != '\n' && c != EOF)
+				c = getc(fp);
+		c = getc(fp);
+	}
+
+	while (c >= '0' && c <= '9') {
+		if (value < 0)
+			value = 0;
+		if (value > (INT_MAX - 9) / 10)
+			return -1;
+		value = value * 10 + (c - '0');
+		c = getc(fp);
+	}
+
+	// the character after the number is the single separator, it is consumed as well
+	if (c != EOF && (value < 0 || c == '#'))
+		ungetc(c, fp);
+	return value;
+}
+
+int readImageHeader(FILE *fp, const char *filename, ImageHeader *header)
+{
+	int c;
+
+	//read image format, the stream may simply be over
+	do {
+		c = getc(fp);
+	} while (c == ' ' || c == '\t' || c == '\r' || c == '\n');
+	if (c == EOF)
+		return 0;
+
+	//check the image format
+	header->format = getc(fp);
+	if (c != 'P' || header->format < '2' || header->format > '6') {
+		fprintf(stderr, "Invalid image format (must be 'P2' to 'P6')\n");
+		exit(1);
+	}
+	header->channels = header->format == '6' || header->format == '3' ? 3 : 1;
+
+	//read image size information
+	header->x = readHeaderValue(fp);
+	header->y = readHeaderValue(fp);
+	if (header->x <= 0 || header->y <= 0) {
+		fprintf(stderr, "Invalid image size (error loading '%s')\n", filename);
+		exit(1);
+	}
+
+	//bitmaps have no rgb component, their pixels are black or white
+	if (header->format == '4') {
+		header->maxval = 1;
+		return 1;
+	}
+
+	//read rgb component
+	header->maxval = readHeaderValue(fp);
+	if (header->maxval < 0) {
+		fprintf(stderr, "Invalid rgb component (error loading '%s')\n", filename);
+		exit(1);
+	}
+
+	//check rgb colors, components have 8 or 16 bits
+	if (header->maxval == 0 || header->maxval > RGB_TOTAL_COLORS_16) {
+		fprintf(stderr, "'%s' does not have 8-bits or 16-bits components\n", filename);
+		exit(1);
+	}
+
+	return 1;
+}
+
+Image *readImage(const char *filename)
+{
+	FILE *fp;
+	errno_t err;
+	ImageHeader header;
+	Image *img;
+
+	//open PPM file for reading
+	err = fopen_s(&fp, filename, "rb");
+	if (err != 0) {
+		fprintf(stderr, "Unable to open file '%s'\n", filename);
+		exit(1);
+	}
+
+	if (!readImageHeader(fp, filename, &header)) {
+		fprintf(stderr, "Empty file '%s'\n", filename);
+		exit(1);
+	}
+
+	//memory allocation for the image and its pixel data
+	img = createImage(header.x, header.y, header.channels, header.maxval, 0);
+	if (!img) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	//read pixel data from file
+	if (header.format == '3' || header.format == '2')
+		readAsciiPixels(fp, filename, img, header.maxval);
+	else
+		readImagePixels(fp, filename, img, header.format);
+	img->format = header.format;
+
+	fclose(fp);
+	return img;
+}
+
+static void initBitmapValues(void)
+{
+	int b, k;
+
+	for (b = 0; b < 256; b++)
+		for (k = 0; k < 8; k++)
+			bitmapValues[b][k] = (unsigned char)(((b >> (7 - k)) & 1) ^ 1);
+}
+
+// Unpack the bitmap (P4) rows, 8 pixels per byte, to gray values of 0 (black) and 1 (white)
+static void readBitmapPixels(FILE *fp, const char *filename, Image *img)
+{
+	size_t packed = ((size_t)img->x + 7) / 8, b;
+	unsigned char *buff, *row;
+	int i, last = img->x % 8 ? img->x % 8 : 8;
+
+	buff = (unsigned char *)malloc(packed);
+	if (!buff) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	pthread_once(&bitmapOnce, initBitmapValues);
+	for (i = 0; i < img->y; i++) {
+		if (fread(buff, packed, 1, fp) != 1) {
+			fprintf(stderr, "Truncated pixel data (error loading '%s')\n", filename);
+			exit(1);
+		}
+
+		// whole bytes are expanded from the table 8 pixels at a time
+		row = imageSamples(img, i);
+		for (b = 0; b + 1 < packed; b++)
+			memcpy(row + 8 * b, bitmapValues[buff[b]], 8);
+		memcpy(row + 8 * b, bitmapValues[buff[b]], last);
+	}
+
+	free(buff);
+}
+
+// Exit when a sample of img is above its maxval, as the text reader does. The filters index lookup
+// tables and histograms of maxval + 1 entries by sample, so those samples can't reach them.
+static void checkSamples(const Image *img, const char *filename)
+{
+	const unsigned char *row;
+	const unsigned short *row16;
+	size_t samples = imageRowSamples(img), k;
+	unsigned int high = 0;
+	int j;
+
+	// every sample fits the widest maxval of its size
+	if (img->maxval == (img->depth == 1 ? RGB_TOTAL_COLORS : RGB_TOTAL_COLORS_16))
+		return;
+
+	for (j = 0; j < img->y; j++) {
+		row = imageSamples(img, j);
+		row16 = imageSamples16(img, j);
+		for (k = 0; k < samples; k++) {
+			if (img->depth == 1)
+				high |= row[k] > img->maxval;
+			else
+				high |= row16[k] > img->maxval;
+		}
+		if (high) {
+			fprintf(stderr, "Invalid pixel value (error loading '%s')\n", filename);
+			exit(1);
+		}
+	}
+}
+
+void readImagePixels(FILE *fp, const char *filename, Image *img, char format)
+{
+	size_t rows;
+	int i;
+
+	if (format == '4') {
+		readBitmapPixels(fp, filename, img);
+		return;
+	}
+
+	// rows are contiguous so it is a single read
+	if (img->stride == imageRowSize(img)) {
+		rows = fread(img->data, img->stride, img->y, fp);
+	}
+	else {
+		for (i = 0; i < img->y; i++)
+			if (fread(imageRow(img, i), imageRowSize(img), 1, fp) != 1)
+				break;
+		rows = i;
+	}
+
+	if (rows != (size_t)img->y) {
+		fprintf(stderr, "Truncated pixel data (error loading '%s')\n", filename);
+		exit(1);
+	}
+
+	// 16-bits components are stored most significant byte first
+	if (img->depth == 2)
+		for (i = 0; i < img->y; i++)
+			bigEndianSamples(imageSamples16(img, i), imageRowSamples(img));
+	checkSamples(img, filename);
+}
+
+// Skip whitespaces and comments of a PPM header held in memory
+static size_t skipHeaderSpaces(const unsigned char *buff, size_t size, size_t pos)
+{
+	while (pos < size) {
+		if (buff[pos] == '#') {
+			while (pos < size && buff[pos] != '\n')
+				pos++;
+		}
+		else if (buff[pos] == ' ' || buff[pos] == '\t' || buff[pos] == '\r' || buff[pos] == '\n')
+			pos++;
+		else
+			break;
+	}
+	return pos;
+}
+
+// Read a decimal number of a PPM header held in memory, returns -1 when there is none
+static int readHeaderNumber(const unsigned char *buff, size_t size, size_t *pos)
+{
+	int value = -1;
+
+	*pos = skipHeaderSpaces(buff, size, *pos);
+	while (*pos < size && buff[*pos] >= '0' && buff[*pos] <= '9') {
+		if (value < 0)
+			value = 0;
+		if (value > (INT_MAX - 9) / 10)
+			return -1;
+		value = value * 10 + (buff[*pos] - '0');
+		(*pos)++;
+	}
+	return value;
+}
+
+// Load a P6 or P5 image by mapping the file in memory instead of reading it.
+// The image data points straight into the mapped view, so there is no copy and no read per row:
+// pages are brought in by the system cache on first access. With copyOnWrite the filters
+// can change the pixels (changed pages become private), otherwise the image is read-only.
+// 16-bits components are put in the host byte order in place, so they need copyOnWrite.
+// The file can't be overwritten while it is mapped, call freeImage() before writing over it.
+// Mapped images are not padded and the pixels are not aligned, they follow the header,
+// 16-bits files whose pixels start at an odd offset are read instead.
+Image *readImageMapped(const char *filename, int copyOnWrite)
+{
+	unsigned char *view;
+	size_t size, pos = 2;
+	Image *img;
+	int i;
+
+	//map PPM file
+	view = (unsigned char *)mapFile(filename, copyOnWrite, &size);
+	if (!view) {
+		fprintf(stderr, "Unable to map file '%s'\n", filename);
+		exit(1);
+	}
+
+	//check the image format, only binary pixels of a byte or more can be used in place
+	if (size < 3 || view[0] != 'P' || (view[1] != '6' && view[1] != '5')) {
+		fprintf(stderr, "Invalid image format (must be 'P6' or 'P5')\n");
+		exit(1);
+	}
+
+	//alloc memory form image
+	img = (Image *)alignedAlloc(sizeof(Image), IMAGE_ALIGNMENT);
+	if (!img) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	//read image size information
+	img->channels = view[1] == '6' ? 3 : 1;
+	img->x = readHeaderNumber(view, size, &pos);
+	img->y = readHeaderNumber(view, size, &pos);
+	if (img->x <= 0 || img->y <= 0) {
+		fprintf(stderr, "Invalid image size (error loading '%s')\n", filename);
+		exit(1);
+	}
+
+	//read and check rgb component
+	img->maxval = readHeaderNumber(view, size, &pos);
+	if (img->maxval <= 0 || img->maxval > RGB_TOTAL_COLORS_16) {
+		fprintf(stderr, "'%s' does not have 8-bits or 16-bits components\n", filename);
+		exit(1);
+	}
+	img->depth = img->maxval > RGB_TOTAL_COLORS ? 2 : 1;
+
+#ifndef HOST_BIG_ENDIAN
+	if (img->depth == 2 && !copyOnWrite) {
+		fprintf(stderr, "'%s' has 16-bits components, it can't be mapped read-only\n", filename);
+		exit(1);
+	}
+#endif
+
+	// a single whitespace separates the header from the pixels
+	pos++;
+	if (pos > size || (size - pos) / img->y / img->channels / img->depth < (size_t)img->x) {
+		fprintf(stderr, "Truncated pixel data (error loading '%s')\n", filename);
+		exit(1);
+	}
+
+	// 16-bits samples after a header of odd length can't be used in place, they are copied
+	if (img->depth == 2 && ((size_t)(view + pos) & 1)) {
+		alignedFree(img);
+		unmapFile(view, size);
+		return readImage(filename);
+	}
+
+	img->stride = imageRowSize(img);
+	img->data = view + pos;
+	img->map = view;
+	img->mapSize = size;
+	img->parent = NULL;
+	img->references = 1;
+	img->format = view[1];
+
+	if (img->depth == 2)
+		for (i = 0; i < img->y; i++)
+			bigEndianSamples(imageSamples16(img, i), imageRowSamples(img));
+	checkSamples(img, filename);
+	return img;
+}
+
+// Write a decimal number, returns its length
+static size_t formatNumber(char *p, unsigned int value)
+{
+	char digits[10];
+	size_t n = 0, k;
+
+	do {
+		digits[n++] = (char)('0' + value % 10);
+		value /= 10;
+	} while (value);
+
+	for (k = 0; k < n; k++)
+		p[k] = digits[n - 1 - k];
+	return n;
+}
+
+size_t formatImageHeader(char *buff, char format, int x, int y, int maxval)
+{
+	size_t length = 0;
+
+	//image format
+	buff[length++] = 'P';
+	buff[length++] = format;
+	buff[length++] = '\n';
+
+	//comments
+	memcpy(buff + length, "# Created by " CREATED_BY "\n", sizeof("# Created by " CREATED_BY "\n") - 1);
+	length += sizeof("# Created by " CREATED_BY "\n") - 1;
+
+	//image size
+	length += formatNumber(buff + length, (unsigned int)x);
+	buff[length++] = ' ';
+	length += formatNumber(buff + length, (unsigned int)y);
+	buff[length++] = '\n';
+
+	// rgb colors, bitmaps have none
+	if (format != '4') {
+		length += formatNumber(buff + length, (unsigned int)maxval);
+		buff[length++] = '\n';
+	}
+	return length;
+}
+
+void writeImageHeader(FILE *fp, char format, int x, int y, int maxval)
+{
+	char header[IMAGE_HEADER_MAX];
+
+	fwrite(header, 1, formatImageHeader(header, format, x, y, maxval), fp);
+}
+
+char imageFormat(const Image *img)
+{
+	if (img->channels == 3)
+		return '6';
+	return img->format == '4' && img->maxval == 1 ? '4' : '5';
+}
+
+// Pack the gray values of a bitmap to 8 pixels per byte, 0 (black) giving a bit set to 1
+static void writeBitmapPixels(FILE *fp, const Image *img)
+{
+	size_t packed = ((size_t)img->x + 7) / 8;
+	unsigned char *buff;
+	const unsigned char *row;
+	int i, k;
+
+	buff = (unsigned char *)malloc(packed);
+	if (!buff) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	for (i = 0; i < img->y; i++) {
+		row = imageSamples(img, i);
+		memset(buff, 0, packed);
+		for (k = 0; k < img->x; k++)
+			buff[k >> 3] |= (unsigned char)((row[k] == 0) << (7 - (k & 7)));
+		fwrite(buff, packed, 1, fp);
+	}
+
+	free(buff);
+}
+
+void writeImagePixels(FILE *fp, const Image *img)
+{
+	unsigned char *buff;
+	int i = 0, rows, count;
+
+	// pixel data, in one go when the rows are not padded
+	if (imageFormat(img) == '4') {
+		writeBitmapPixels(fp, img);
+	}
+	else if (img->depth == 2) {
+		// 16-bits components are swapped to big-endian in a buffer of a few rows at a time
+		rows = (int)(WRITE_BUFFER / imageRowSize(img));
+		if (rows < 1)
+			rows = 1;
+		buff = (unsigned char *)malloc(rows * imageRowSize(img));
+		if (!buff) {
+			fprintf(stderr, "Unable to allocate memory\n");
+			exit(1);
+		}
+
+		for (i = 0; i < img->y; i += rows) {
+			for (count = 0; count < rows && i + count < img->y; count++)
+				memcpy(buff + count * imageRowSize(img), imageSamples(img, i + count), imageRowSize(img));
+			bigEndianSamples((unsigned short *)buff, imageRowSamples(img) * count);
+			fwrite(buff, imageRowSize(img), count, fp);
+		}
+		free(buff);
+	}
+	else if (img->stride == imageRowSize(img)) {
+		fwrite(img->data, img->stride, img->y, fp);
+	}
+	else {
+		for (i = 0; i < img->y; i++)
+			fwrite(imageRow(img, i), imageRowSize(img), 1, fp);
+	}
+}
+
+FILE *createOutputFile(const char *filename, char **tempName, unsigned long long size)
+{
+	FILE *fp = NULL;
+	size_t length = strlen(filename), end;
+	char *name;
+	int attempt;
+
+	// the temporary file is in the same directory so the rename never moves data,
+	// a number keeps writers of the same target from sharing it
+	name = (char *)malloc(length + 16);
+	if (!name) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+	memcpy(name, filename, length);
+	name[length] = '.';
+	for (attempt = 0; attempt < 1000; attempt++) {
+		end = length + 1 + formatNumber(name + length + 1, (unsigned int)attempt);
+		memcpy(name + end, ".tmp", 5);
+		fp = createNewFile(name);
+		if (fp || errno != EEXIST)
+			break;
+	}
+	if (!fp) {
+		fprintf(stderr, "Unable to open file '%s'\n", filename);
+		exit(1);
+	}
+
+	setvbuf(fp, NULL, _IOFBF, WRITE_BUFFER);
+	if (size)
+		preallocateFile(fp, size);
+
+	*tempName = name;
+	return fp;
+}
+
+void commitOutputFile(FILE *fp, const char *filename, char *tempName)
+{
+	int failed;
+
+	// the data must be on the disk before the rename makes it the target
+	failed = ferror(fp) || syncFile(fp) != 0;
+	failed = fclose(fp) != 0 || failed;
+	if (failed || replaceFile(tempName, filename) != 0) {
+		remove(tempName);
+		fprintf(stderr, "Unable to write file '%s'\n", filename);
+		exit(1);
+	}
+	free(tempName);
+}
+
+void writeImage(const Image *img, const char *filename)
+{
+	FILE *fp;
+	char header[IMAGE_HEADER_MAX], *tempName;
+	size_t headerLength, rowSize;
+
+	// the final size is known up front, header included
+	headerLength = formatImageHeader(header, imageFormat(img), img->x, img->y, img->maxval);
+	rowSize = imageFormat(img) == '4' ? ((size_t)img->x + 7) / 8 : imageRowSize(img);
+
+	fp = createOutputFile(filename, &tempName, headerLength + (unsigned long long)rowSize * img->y);
+	fwrite(header, 1, headerLength, fp);
+	writeImagePixels(fp, img);
+	commitOutputFile(fp, filename, tempName);
+}
+
+// Release an image, unmapping the file for mapped images
+void freeImage(Image *img)
+{
+	Image *owner;
+
+	if (!img)
+		return;
+
+	// a view only holds a reference to the pixels of its owner
+	owner = img->parent ? img->parent : img;
+	if (img->parent)
+		alignedFree(img);
+	if (atomicAdd(&owner->references, -1) > 0)
+		return;
+
+	if (owner->map)
+		unmapFile(owner->map, owner->mapSize);
+
+	// allocated images hold the pixels in the same block
+	alignedFree(owner);
+}
@@ -0,0 +1,109 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+// Structure for PPM Pixels
+typedef struct {
+	unsigned char red, green, blue;
+} Pixel;
+
+// Structure for PPM Pixels with 16-bits components (maxval above 255)
+typedef struct {
+	unsigned short red, green, blue;
+} Pixel16;
+
+// Structure for the Image
+// The pixels live in one buffer, row after row, a new row starting every stride bytes
+// 16-bits samples are kept in the host byte order, they are swapped when the file is read and written.
+// Grayscale images (PGM) have a single channel, bitmaps (PBM) are grayscale images with maxval 1.
+// A view is a rectangle of another image sharing its pixels, see createImageView().
+typedef struct Image {
+	int x, y;
+	int channels; // Components per pixel, 3 for RGB and 1 for grayscale
+	int maxval; // Largest component value, 255 for 8-bits images
+	int depth; // Bytes per component, 1 or 2 when maxval is above 255
+	size_t stride; // Bytes from a row to the next one (x * channels * depth, or more when rows are padded)
+	unsigned char *data; // First pixel of the first row
+	void *map; // Mapped file view backing the pixels (NULL when the pixels are allocated)
+	size_t mapSize;
+	struct Image *parent; // Image owning the pixels of a view (NULL when the image owns them)
+	volatile long references; // Owners only, the owner and its views holding the pixels
+	char format; // Magic number digit of the file the image comes from, 0 for new images
+} Image;
+
+// Structure for the header of a PPM file
+typedef struct {
+	char format; // Magic number digit: '6'/'3' for binary/ASCII RGB, '5'/'2' for gray and '4' for bitmaps
+	int x, y;
+	int channels;
+	int maxval; // 1 for bitmaps, their header has no maxval
+} ImageHeader;
+
+#define CREATED_BY "PPM IMAGE EDITOR"
+#define IMAGE_HEADER_MAX (sizeof(CREATED_BY) + 64) // Bytes of the longest header written
+#define RGB_TOTAL_COLORS 255
+#define RGB_TOTAL_COLORS_16 65535 // Largest maxval, with 16-bits components
+#define IMAGE_ALIGNMENT 64 // Pixel buffer alignment, padded rows also start at this alignment
+
+// Pixel access, rows are walked linearly with imageRow() and indexed by the x position.
+// imageRow() is for images with depth 1 and imageRow16() for images with depth 2.
+#define imageRow(img, j) ((Pixel *)((img)->data + (size_t)(j) * (img)->stride))
+#define imagePixel(img, i, j) (imageRow(img, j) + (i))
+#define imageRow16(img, j) ((Pixel16 *)((img)->data + (size_t)(j) * (img)->stride))
+#define imagePixel16(img, i, j) (imageRow16(img, j) + (i))
+
+// Component access for any number of channels, with depth 1 and depth 2
+#define imageSamples(img, j) ((img)->data + (size_t)(j) * (img)->stride)
+#define imageSamples16(img, j) ((unsigned short *)imageSamples(img, j))
+
+// Components in a row and bytes of pixel data in a row, without padding
+#define imageRowSamples(img) ((size_t)(img)->x * (img)->channels)
+#define imageRowSize(img) (imageRowSamples(img) * (img)->depth)
+
+// Allocate an image with a single allocation, padRows aligns every row to IMAGE_ALIGNMENT.
+// The components take 2 bytes when maxval is above 255.
+Image *createImage(int x, int y, int channels, int maxval, int padRows);
+
+// Copy the width x height pixels at (sx, sy) of src to (dx, dy) of dst, which has the channels and maxval of src
+void copyImageRect(Image *dst, int dx, int dy, const Image *src, int sx, int sy, int width, int height);
+
+// View of the width x height pixels at (x0, y0) of img, without copying them: the view has the
+// stride of img and its first pixel, so filtering it changes those pixels of img, and the filters
+// see it as a whole image. Views of views share the pixels of the first image. The pixels are freed
+// with the last of the owner and its views, in any order. Returns NULL when the rectangle isn't in img.
+Image *createImageView(Image *img, int x0, int y0, int width, int height);
+
+// Load a PPM file in a new allocated image
+Image *readImage(const char *filename);
+
+// Load a P6 or P5 file by mapping it in memory, see image.c
+Image *readImageMapped(const char *filename, int copyOnWrite);
+
+// Read the header of the next image of a PPM stream, leaving fp at the first pixel.
+// Returns 0 when the stream is over, exits on invalid headers.
+int readImageHeader(FILE *fp, const char *filename, ImageHeader *header);
+
+// Read the binary (P6, P5 or P4) pixels of img from fp, right after the header
+void readImagePixels(FILE *fp, const char *filename, Image *img, char format);
+
+// Binary format digit an image is written with: '6' for RGB, '5' for gray and '4' for bitmaps.
+// Only images read from bitmaps are written as bitmaps, a P5 file of maxval 1 stays P5.
+char imageFormat(const Image *img);
+
+// Format the header of an image in buff, which holds IMAGE_HEADER_MAX bytes. Returns its length.
+size_t formatImageHeader(char *buff, char format, int x, int y, int maxval);
+void writeImageHeader(FILE *fp, char format, int x, int y, int maxval);
+void writeImagePixels(FILE *fp, const Image *img);
+
+// Files are written to a new temporary file next to filename, preallocated to size bytes when
+// size isn't 0. commitOutputFile() flushes it to the disk and renames it over filename, so a
+// crash while writing never leaves filename half written.
+FILE *createOutputFile(const char *filename, char **tempName, unsigned long long size);
+void commitOutputFile(FILE *fp, const char *filename, char *tempName);
+
+void writeImage(const Image *img, const char *filename);
+void freeImage(Image *img);
+
+#endif
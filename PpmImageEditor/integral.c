@@ -0,0 +1,142 @@
+#include "integral.h"
+#include "parallel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Structure for the passes of the table build
+typedef struct {
+	const Image *img;
+	IntegralImage *table;
+} IntegralTask;
+
+// Running sums along a row of the image, written to the row below it in the table
+#define DEFINE_INTEGRAL_ROW(name, Sample, Sum) \
+static void name(const Sample *src, Sum *dst, unsigned long long *squares, int x, int channels) \
+{ \
+	int i, c; \
+	size_t k; \
+ \
+	for (c = 0; c < channels; c++) \
+		dst[c] = 0; \
+	for (i = 0; i < x; i++) { \
+		for (c = 0; c < channels; c++) { \
+			k = (size_t)channels * i + c; \
+			dst[k + channels] = dst[k] + src[k]; \
+		} \
+	} \
+ \
+	if (!squares) \
+		return; \
+	for (c = 0; c < channels; c++) \
+		squares[c] = 0; \
+	for (k = 0; k < (size_t)x * channels; k++) \
+		squares[k + channels] = squares[k] + (unsigned long long)src[k] * src[k]; \
+}
+
+DEFINE_INTEGRAL_ROW(integralRow, unsigned char, unsigned int)
+DEFINE_INTEGRAL_ROW(integralRow16, unsigned short, unsigned int)
+DEFINE_INTEGRAL_ROW(integralRowWide, unsigned char, unsigned long long)
+DEFINE_INTEGRAL_ROW(integralRowWide16, unsigned short, unsigned long long)
+
+static void threadIntegralRows(void *arg, int index, int count)
+{
+	IntegralTask *task = (IntegralTask *)arg;
+	const Image *img = task->img;
+	IntegralImage *table = task->table;
+	unsigned long long *squares;
+	int j, startY = (int)((long long)img->y * index / count), endY = (int)((long long)img->y * (index + 1) / count);
+
+	for (j = startY; j < endY; j++) {
+		squares = table->squares ? table->squares + table->stride * (j + 1) : NULL;
+		if (table->wide) {
+			unsigned long long *dst = (unsigned long long *)table->sums + table->stride * (j + 1);
+			if (img->depth == 1)
+				integralRowWide(imageSamples(img, j), dst, squares, img->x, img->channels);
+			else
+				integralRowWide16(imageSamples16(img, j), dst, squares, img->x, img->channels);
+		}
+		else {
+			unsigned int *dst = (unsigned int *)table->sums + table->stride * (j + 1);
+			if (img->depth == 1)
+				integralRow(imageSamples(img, j), dst, squares, img->x, img->channels);
+			else
+				integralRow16(imageSamples16(img, j), dst, squares, img->x, img->channels);
+		}
+	}
+}
+
+// Running sums down the columns, each thread takes a slice of every row
+static void threadIntegralColumns(void *arg, int index, int count)
+{
+	IntegralTask *task = (IntegralTask *)arg;
+	IntegralImage *table = task->table;
+	size_t start = table->stride * index / count, end = table->stride * (index + 1) / count, k;
+	int j;
+
+	for (j = 2; j <= table->y; j++) {
+		if (table->wide) {
+			unsigned long long *row = (unsigned long long *)table->sums + table->stride * j;
+			for (k = start; k < end; k++)
+				row[k] += row[k - table->stride];
+		}
+		else {
+			unsigned int *row = (unsigned int *)table->sums + table->stride * j;
+			for (k = start; k < end; k++)
+				row[k] += row[k - table->stride];
+		}
+		if (table->squares) {
+			unsigned long long *row = table->squares + table->stride * j;
+			for (k = start; k < end; k++)
+				row[k] += row[k - table->stride];
+		}
+	}
+}
+
+IntegralImage *createIntegralImage(const Image *img, int squares)
+{
+	IntegralImage *table;
+	IntegralTask task;
+	size_t entries;
+
+	table = (IntegralImage *)malloc(sizeof(IntegralImage));
+	if (!table) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	table->x = img->x;
+	table->y = img->y;
+	table->channels = img->channels;
+	table->stride = ((size_t)img->x + 1) * img->channels;
+	table->wide = (double)img->x * img->y * img->maxval > 4294967295.0;
+	entries = table->stride * ((size_t)img->y + 1);
+
+	table->sums = malloc(entries * (table->wide ? sizeof(unsigned long long) : sizeof(unsigned int)));
+	table->squares = squares ? (unsigned long long *)malloc(entries * sizeof(unsigned long long)) : NULL;
+	if (!table->sums || (squares && !table->squares)) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	// the first row is 0, the first column is written by the row pass
+	memset(table->sums, 0, table->stride * (table->wide ? sizeof(unsigned long long) : sizeof(unsigned int)));
+	if (table->squares)
+		memset(table->squares, 0, table->stride * sizeof(unsigned long long));
+
+	task.img = img;
+	task.table = table;
+	parallelRun(threadIntegralRows, &task);
+	parallelRun(threadIntegralColumns, &task);
+	return table;
+}
+
+void freeIntegralImage(IntegralImage *table)
+{
+	if (!table)
+		return;
+
+	free(table->squares);
+	free(table->sums);
+	free(table);
+}
@@ -0,0 +1,52 @@
+#ifndef INTEGRAL_H
+#define INTEGRAL_H
+
+#include "platform.h"
+#include "image.h"
+
+// Summed-area table of an image. Entry (i, j) of a channel is the sum of the samples of the
+// pixels left of column i and above row j, so the table has one more row and column than the
+// image, all 0, and the sum of any rectangle takes 4 lookups whatever its size.
+typedef struct {
+	int x, y; // Size of the image
+	int channels;
+	int wide; // Nonzero when the sums take 64 bits, they take 32 bits when the whole image sum fits
+	size_t stride; // Sums per row of the table, (x + 1) * channels
+	void *sums;
+	unsigned long long *squares; // Same table for the squared samples, NULL when not asked for
+} IntegralImage;
+
+// Build the table of img, with the squared samples table when squares isn't 0.
+// Both passes are split between parallelThreads() threads.
+IntegralImage *createIntegralImage(const Image *img, int squares);
+void freeIntegralImage(IntegralImage *table);
+
+#define integralIndex(table, i, j, c) ((table)->stride * (size_t)(j) + (size_t)(table)->channels * (i) + (c))
+
+// Sum of channel c over the columns x0 to x1 - 1 and the rows y0 to y1 - 1, which must be inside the image
+static INLINE unsigned long long integralSum(const IntegralImage *table, int x0, int y0, int x1, int y1, int c)
+{
+	size_t a = integralIndex(table, x0, y0, c), b = integralIndex(table, x1, y0, c);
+	size_t d = integralIndex(table, x0, y1, c), e = integralIndex(table, x1, y1, c);
+
+	// 32-bits sums wrap around but their differences are right, the whole image sum fits
+	if (table->wide) {
+		const unsigned long long *sums = (const unsigned long long *)table->sums;
+		return sums[e] - sums[b] - sums[d] + sums[a];
+	}
+	else {
+		const unsigned int *sums = (const unsigned int *)table->sums;
+		return (unsigned int)(sums[e] - sums[b] - sums[d] + sums[a]);
+	}
+}
+
+// Sum of the squared samples of the same rectangle, the table must have been built with squares
+static INLINE unsigned long long integralSquares(const IntegralImage *table, int x0, int y0, int x1, int y1, int c)
+{
+	const unsigned long long *squares = table->squares;
+
+	return squares[integralIndex(table, x1, y1, c)] - squares[integralIndex(table, x1, y0, c)] -
+		squares[integralIndex(table, x0, y1, c)] + squares[integralIndex(table, x0, y0, c)];
+}
+
+#endif
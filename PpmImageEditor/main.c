@@ -0,0 +1,321 @@
+#include "platform.h"
+#include "image.h"
+#include "filters.h"
+#include "parallel.h"
+#include "stream.h"
+#include "pipeline.h"
+#include "ascii.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// Command line front end, it runs the same read/filter/write steps as the window on many files
+
+#define MAX_FILTERS 16 // Filters that can be chained on the command line
+
+// Structure for a batch of files
+typedef struct {
+	char **inputs;
+	int count;
+	const char *outputDir;
+	const char *filters[MAX_FILTERS]; // Filter names, made into the pipeline once the options are read
+	int filterCount;
+	Pipeline *pipeline;
+	int threads; // Threads for the whole batch, shared by the files processed at once
+	int workers; // Files processed at once
+	int mapped; // Map the input files instead of reading them
+	int decimate; // Factor the inputs are shrunk by while they are read, 1 to read them as they are
+	int ascii; // Write the outputs as text, P3 and P2
+	int band; // Mean blur the inputs a band of rows at a time instead of loading them, see streamMeanBlur()
+	int next; // Next file to process
+	pthread_mutex_t lock;
+} Batch;
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: ppmedit [options] -o outdir input...\n"
+		"       ppmedit [options] --stream < frames > frames\n"
+		"inputs are PPM, PGM or PBM files, or directories of them\n"
+		"  -o dir      write the filtered images in dir, with the name of their input\n"
+		"  -f filter   filter to apply (blur, fastblur, box, mean, median, invert, brightness=a,\n"
+		"              contrast=a, gamma=a, levels=a:b, threshold=a, resize=WxH[:area|bilinear|lanczos],\n"
+		"              rotate90, rotate180, rotate270, mirror, flip, transpose, transverse, crop=WxH+X+Y),\n"
+		"              repeat it to chain filters, blur by default. Chained filters run together tile by tile\n"
+		"  -s sigma    standard deviation of the Gaussian blurs, 1 by default\n"
+		"  -r radius   radius of the box, mean (127 at most) and median filters, 2 by default\n"
+		"  -j threads  threads to use, the number of processors by default\n"
+		"  -m          map the input files in memory instead of reading them (P6 and P5 only)\n"
+		"  -d factor   shrink the inputs by factor as they are read, P6 and P5 files are never loaded whole\n"
+		"  -a          write the filtered images as text (P3 and P2) instead of binary\n"
+		"  --band      mean blur P6 and P5 inputs of radius -r a band of rows at a time, for images too large\n"
+		"              to load, only with -f mean\n"
+		"  --stream    filter the frames of the standard input into the standard output\n");
+	exit(1);
+}
+
+// Nonzero when the file name has a netpbm extension
+static int isImageFile(const char *path)
+{
+	const char *ext = strrchr(path, '.');
+
+	if (!ext)
+		return 0;
+	return strcmp(ext, ".ppm") == 0 || strcmp(ext, ".pgm") == 0 || strcmp(ext, ".pbm") == 0 ||
+		strcmp(ext, ".pnm") == 0 || strcmp(ext, ".PPM") == 0 || strcmp(ext, ".PGM") == 0 ||
+		strcmp(ext, ".PBM") == 0 || strcmp(ext, ".PNM") == 0;
+}
+
+static void addInput(Batch *batch, int *size, char *path)
+{
+	if (batch->count == *size) {
+		*size = *size ? 2 * *size : 64;
+		batch->inputs = (char **)realloc(batch->inputs, *size * sizeof(char *));
+		if (!batch->inputs) {
+			fprintf(stderr, "Unable to allocate memory\n");
+			exit(1);
+		}
+	}
+	batch->inputs[batch->count++] = path;
+}
+
+// Output path of an input: the output directory followed by the input file name
+static char *outputPath(const char *outputDir, const char *input)
+{
+	const char *name = input, *p;
+	size_t dirLength = strlen(outputDir), nameLength;
+	char *path;
+
+	for (p = input; *p; p++)
+		if (*p == '/' || *p == '\\')
+			name = p + 1;
+	nameLength = strlen(name);
+
+	path = (char *)malloc(dirLength + nameLength + 2);
+	if (!path) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+	memcpy(path, outputDir, dirLength);
+	path[dirLength] = '/';
+	memcpy(path + dirLength + 1, name, nameLength + 1);
+	return path;
+}
+
+static void processFile(const Batch *batch, const char *input)
+{
+	char *output = outputPath(batch->outputDir, input);
+	Image *img;
+	int x, y;
+
+	// the banded blur goes from file to file, the image is never in memory
+	if (batch->band) {
+		streamMeanBlur(input, output, blurRadius());
+		free(output);
+		return;
+	}
+
+	// shrunk files are read a band at a time, and a mapped file can't be written over while it is mapped
+	if (batch->decimate > 1)
+		img = readImageDecimated(input, batch->decimate);
+	else if (batch->mapped && strcmp(input, output) != 0)
+		img = readImageMapped(input, 1);
+	else
+		img = readImage(input);
+
+	// the crops must start in the image, which is only known once it is read
+	x = img->x;
+	y = img->y;
+	if (!pipelineImageSize(batch->pipeline, &x, &y)) {
+		fprintf(stderr, "Crop outside of the %dx%d image '%s'\n", img->x, img->y, input);
+		exit(1);
+	}
+
+	img = runPipeline(batch->pipeline, img);
+	if (batch->ascii)
+		writeImageAscii(img, output);
+	else
+		writeImage(img, output);
+	freeImage(img);
+	free(output);
+}
+
+static void *batchWorker(void *arg)
+{
+	Batch *batch = (Batch *)arg;
+	int index, left, active, threads;
+
+	for (;;) {
+		pthread_mutex_lock(&batch->lock);
+		index = batch->next++;
+		pthread_mutex_unlock(&batch->lock);
+		if (index >= batch->count)
+			break;
+
+		// the threads are shared between the files processed at once, when fewer
+		// files are left than workers the last ones get more threads each
+		left = batch->count - index;
+		active = left < batch->workers ? left : batch->workers;
+		threads = batch->threads / active;
+		setParallelThreads(threads > 0 ? threads : 1);
+
+		processFile(batch, batch->inputs[index]);
+	}
+	return NULL;
+}
+
+static int runBatch(Batch *batch)
+{
+	pthread_t *thread;
+	int t, rc;
+
+	batch->workers = batch->count < batch->threads ? batch->count : batch->threads;
+	batch->next = 0;
+	pthread_mutex_init(&batch->lock, NULL);
+
+	thread = (pthread_t *)malloc(batch->workers * sizeof(pthread_t));
+	if (!thread) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	for (t = 0; t < batch->workers; t++) {
+		rc = pthread_create(&thread[t], NULL, batchWorker, batch);
+		if (rc) {
+			fprintf(stderr, "ERROR; return code from pthread_create() is %d\n", rc);
+			exit(-1);
+		}
+	}
+	for (t = 0; t < batch->workers; t++)
+		pthread_join(thread[t], NULL);
+
+	pthread_mutex_destroy(&batch->lock);
+	free(thread);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	Batch batch;
+	char **files;
+	double sigma;
+	int i, k, radius, fileCount, size = 0, stream = 0;
+
+	memset(&batch, 0, sizeof(batch));
+	batch.threads = hardwareThreads();
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			batch.outputDir = argv[++i];
+		}
+		else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+			if (batch.filterCount == MAX_FILTERS)
+				usage();
+			batch.filters[batch.filterCount++] = argv[++i];
+		}
+		else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			sigma = atof(argv[++i]);
+			if (sigma <= 0)
+				usage();
+			setBlurSigma(sigma);
+		}
+		else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+			radius = atoi(argv[++i]);
+			if (radius < 1)
+				usage();
+			setBlurRadius(radius);
+		}
+		else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+			batch.threads = atoi(argv[++i]);
+			if (batch.threads < 1)
+				usage();
+		}
+		else if (strcmp(argv[i], "-m") == 0) {
+			batch.mapped = 1;
+		}
+		else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+			batch.decimate = atoi(argv[++i]);
+			if (batch.decimate < 1)
+				usage();
+		}
+		else if (strcmp(argv[i], "-a") == 0) {
+			batch.ascii = 1;
+		}
+		else if (strcmp(argv[i], "--band") == 0) {
+			batch.band = 1;
+		}
+		else if (strcmp(argv[i], "--stream") == 0) {
+			stream = 1;
+		}
+		else if (argv[i][0] == '-') {
+			usage();
+		}
+		else if (isDirectory(argv[i])) {
+			// directories give the images they hold
+			files = listDirectory(argv[i], &fileCount);
+			for (k = 0; k < fileCount; k++) {
+				if (isImageFile(files[k]))
+					addInput(&batch, &size, files[k]);
+				else
+					free(files[k]);
+			}
+			free(files);
+		}
+		else {
+			addInput(&batch, &size, argv[i]);
+		}
+	}
+
+	// the banded blur is a single mean blur read and written by rows
+	if (batch.ascii && (stream || batch.band)) {
+		fprintf(stderr, "-a only writes files, without --stream or --band\n");
+		return 1;
+	}
+	if (batch.band && (stream || batch.mapped || batch.decimate > 1 || batch.filterCount > 1 ||
+		(batch.filterCount == 1 && strcmp(batch.filters[0], "mean") != 0))) {
+		fprintf(stderr, "--band only runs the mean filter on files, without -m, -d or --stream\n");
+		return 1;
+	}
+	if (batch.band && blurRadius() > MEAN_MAX_RADIUS) {
+		fprintf(stderr, "--band blurs with a radius of %d at most\n", MEAN_MAX_RADIUS);
+		return 1;
+	}
+
+	// the 16-bits column sums of the mean blur limit its radius
+	for (k = 0; k < batch.filterCount; k++) {
+		if (strcmp(batch.filters[k], "mean") == 0 && blurRadius() > MEAN_MAX_RADIUS) {
+			fprintf(stderr, "The radius of the mean filter can't be above %d\n", MEAN_MAX_RADIUS);
+			return 1;
+		}
+	}
+
+	// the threads of the batch submit work to the pool and take part in it
+	setPoolThreads(batch.threads - 1);
+
+	// the filters take the sigma and radius given anywhere on the command line
+	if (batch.filterCount == 0)
+		batch.filters[batch.filterCount++] = "blur";
+	batch.pipeline = createPipeline();
+	for (k = 0; k < batch.filterCount; k++) {
+		if (!pipelineAdd(batch.pipeline, batch.filters[k])) {
+			fprintf(stderr, "Unknown filter '%s'\n", batch.filters[k]);
+			return 1;
+		}
+	}
+
+	if (stream) {
+		setParallelThreads(batch.threads);
+		setBinaryMode(stdin);
+		setBinaryMode(stdout);
+		setvbuf(stdin, NULL, _IOFBF, 1 << 20);
+		setvbuf(stdout, NULL, _IOFBF, 1 << 20);
+		streamFrames(stdin, stdout, "stdin", batch.pipeline);
+		return 0;
+	}
+
+	if (!batch.outputDir || batch.count == 0)
+		usage();
+
+	return runBatch(&batch);
+}
@@ -0,0 +1,292 @@
+#include "filters.h"
+#include "parallel.h"
+#include "tile.h"
+#include "simd.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MEDIAN_BINS 256 // Bins of the histograms of 8-bits samples
+#define MEDIAN_COARSE 16 // Coarse bins, each covers 16 bins
+
+// Compare and exchange steps leaving the median of 9 values at index 4, the smallest value of
+// each pair goes to the first index
+static const unsigned char network9[][2] = {
+	{ 1, 2 }, { 4, 5 }, { 7, 8 }, { 0, 1 }, { 3, 4 }, { 6, 7 }, { 1, 2 }, { 4, 5 }, { 7, 8 }, { 0, 3 },
+	{ 5, 8 }, { 4, 7 }, { 3, 6 }, { 1, 4 }, { 2, 5 }, { 4, 7 }, { 4, 2 }, { 6, 4 }, { 4, 2 },
+};
+
+// Same for 25 values and index 12: the steps of Batcher's merge sort of 32 values that can
+// change index 12, the values past 24 being larger than any other
+static const unsigned char network25[][2] = {
+	{ 0, 1 }, { 2, 3 }, { 4, 5 }, { 6, 7 }, { 8, 9 }, { 10, 11 }, { 12, 13 }, { 14, 15 }, { 16, 17 }, { 18, 19 },
+	{ 20, 21 }, { 22, 23 }, { 0, 2 }, { 1, 3 }, { 4, 6 }, { 5, 7 }, { 8, 10 }, { 9, 11 }, { 12, 14 }, { 13, 15 },
+	{ 16, 18 }, { 17, 19 }, { 20, 22 }, { 21, 23 }, { 1, 2 }, { 5, 6 }, { 9, 10 }, { 13, 14 }, { 17, 18 }, { 21, 22 },
+	{ 0, 4 }, { 1, 5 }, { 2, 6 }, { 3, 7 }, { 8, 12 }, { 9, 13 }, { 10, 14 }, { 11, 15 }, { 16, 20 }, { 17, 21 },
+	{ 18, 22 }, { 19, 23 }, { 2, 4 }, { 3, 5 }, { 10, 12 }, { 11, 13 }, { 18, 20 }, { 19, 21 }, { 1, 2 }, { 3, 4 },
+	{ 5, 6 }, { 9, 10 }, { 11, 12 }, { 13, 14 }, { 17, 18 }, { 19, 20 }, { 21, 22 }, { 0, 8 }, { 1, 9 }, { 2, 10 },
+	{ 3, 11 }, { 4, 12 }, { 5, 13 }, { 6, 14 }, { 7, 15 }, { 16, 24 }, { 4, 8 }, { 5, 9 }, { 6, 10 }, { 7, 11 },
+	{ 20, 24 }, { 2, 4 }, { 3, 5 }, { 6, 8 }, { 7, 9 }, { 10, 12 }, { 11, 13 }, { 18, 20 }, { 19, 21 }, { 22, 24 },
+	{ 1, 2 }, { 3, 4 }, { 5, 6 }, { 7, 8 }, { 9, 10 }, { 11, 12 }, { 13, 14 }, { 17, 18 }, { 19, 20 }, { 21, 22 },
+	{ 23, 24 }, { 0, 16 }, { 1, 17 }, { 2, 18 }, { 3, 19 }, { 4, 20 }, { 5, 21 }, { 6, 22 }, { 7, 23 }, { 8, 24 },
+	{ 8, 16 }, { 9, 17 }, { 10, 18 }, { 11, 19 }, { 12, 20 }, { 13, 21 }, { 6, 10 }, { 7, 11 }, { 12, 16 }, { 13, 17 },
+	{ 10, 12 }, { 11, 13 }, { 11, 12 },
+};
+
+// Structure for the tiles of a median filter
+typedef struct {
+	Image *img;
+	const Image *src; // Copy of img, the tiles read the pixels around them after their neighbours wrote theirs
+	int radius;
+	int tileWidth;
+	unsigned char *scratch; // scratchSize bytes for every worker
+	size_t scratchSize;
+} MedianTask;
+
+#define clampIndex(i, n) ((i) < 0 ? 0 : (i) >= (n) ? (n) - 1 : (i))
+
+// Median of the 3x3 or 5x5 windows of a tile. The window rows are copied with their borders
+// repeated, then every window position becomes a plane holding that sample for the whole tile
+// row, and the network runs on the planes: each step is a min and a max over two runs of samples,
+// done by the vector kernels.
+#define DEFINE_MEDIAN_NETWORK(name, Sample, MINMAX) \
+static void name(MedianTask *task, const Tile *tile, Sample *scratch, const unsigned char (*network)[2], int steps) \
+{ \
+	const Image *src = task->src; \
+	int radius = task->radius, size = 2 * radius + 1, channels = src->channels; \
+	int i, j, k, c, s, column; \
+	size_t samples = (size_t)(tile->x1 - tile->x0) * channels, padded = samples + 2 * (size_t)radius * channels; \
+	Sample *rows = scratch, *planes = scratch + padded * size; \
+	const Sample *row; \
+ \
+	for (j = tile->y0; j < tile->y1; j++) { \
+		for (k = 0; k < size; k++) { \
+			row = (const Sample *)imageSamples(src, clampIndex(j + k - radius, src->y)); \
+			for (i = 0; i < tile->x1 - tile->x0 + 2 * radius; i++) { \
+				column = tile->x0 + i - radius; \
+				column = clampIndex(column, src->x); \
+				for (c = 0; c < channels; c++) \
+					rows[padded * k + (size_t)channels * i + c] = row[(size_t)channels * column + c]; \
+			} \
+		} \
+		for (k = 0; k < size * size; k++) \
+			memcpy(planes + samples * k, rows + padded * (k / size) + (size_t)channels * (k % size), samples * sizeof(Sample)); \
+ \
+		for (s = 0; s < steps; s++) \
+			MINMAX(planes + samples * network[s][0], planes + samples * network[s][1], samples); \
+ \
+		memcpy((Sample *)imageSamples(task->img, j) + (size_t)channels * tile->x0, planes + samples * (size * size / 2), \
+			samples * sizeof(Sample)); \
+	} \
+}
+
+DEFINE_MEDIAN_NETWORK(medianNetwork, unsigned char, simdKernels()->minMax)
+DEFINE_MEDIAN_NETWORK(medianNetwork16, unsigned short, simdKernels()->minMax16)
+
+// Median of the windows of a tile of 8-bits samples in constant time per pixel (Perreault and
+// Hebert). Each column of the tile and its halo keeps the histogram of the samples of the window
+// rows, moved down by one sample in and one out per row. The window histogram moves right by
+// adding a column histogram and taking one away, on the 16 coarse bins only: the fine bins of a
+// coarse bin are brought up to date when the median falls in it, usually a few columns later.
+static void medianHistogram(MedianTask *task, const Tile *tile, unsigned char *scratch)
+{
+	const Image *src = task->src;
+	int radius = task->radius, size = 2 * radius + 1, channels = src->channels;
+	int columns = tile->x1 - tile->x0 + 2 * radius, half = size * size / 2;
+	int i, j, k, c, q, t, bin, sum, row;
+	unsigned short *fine = (unsigned short *)scratch, *coarse = fine + (size_t)columns * MEDIAN_BINS;
+	unsigned int kernelCoarse[MEDIAN_COARSE], kernelFine[MEDIAN_BINS];
+	int updated[MEDIAN_COARSE]; // Column each coarse bin of kernelFine is up to date for
+	const unsigned char *in, *out;
+	unsigned char *dst;
+
+	for (c = 0; c < channels; c++) {
+		memset(fine, 0, (size_t)columns * (MEDIAN_BINS + MEDIAN_COARSE) * sizeof(unsigned short));
+		for (k = -radius; k <= radius; k++) {
+			in = imageSamples(src, clampIndex(tile->y0 + k, src->y));
+			for (q = 0; q < columns; q++) {
+				i = clampIndex(tile->x0 + q - radius, src->x);
+				fine[MEDIAN_BINS * q + in[channels * i + c]]++;
+				coarse[MEDIAN_COARSE * q + in[channels * i + c] / MEDIAN_COARSE]++;
+			}
+		}
+
+		for (j = tile->y0; j < tile->y1; j++) {
+			// the row above the window leaves the columns and the row below enters them
+			if (j > tile->y0) {
+				row = j - radius - 1;
+				out = imageSamples(src, clampIndex(row, src->y));
+				row = j + radius;
+				in = imageSamples(src, clampIndex(row, src->y));
+				for (q = 0; q < columns; q++) {
+					i = clampIndex(tile->x0 + q - radius, src->x);
+					fine[MEDIAN_BINS * q + out[channels * i + c]]--;
+					coarse[MEDIAN_COARSE * q + out[channels * i + c] / MEDIAN_COARSE]--;
+					fine[MEDIAN_BINS * q + in[channels * i + c]]++;
+					coarse[MEDIAN_COARSE * q + in[channels * i + c] / MEDIAN_COARSE]++;
+				}
+			}
+
+			memset(kernelCoarse, 0, sizeof(kernelCoarse));
+			for (q = 0; q < size; q++)
+				for (k = 0; k < MEDIAN_COARSE; k++)
+					kernelCoarse[k] += coarse[MEDIAN_COARSE * q + k];
+			for (k = 0; k < MEDIAN_COARSE; k++)
+				updated[k] = -size;
+
+			dst = imageSamples(task->img, j) + (size_t)channels * tile->x0 + c;
+			for (t = 0; t < tile->x1 - tile->x0; t++) {
+				// window t covers the columns t to t + 2 * radius
+				if (t > 0) {
+					for (k = 0; k < MEDIAN_COARSE; k++)
+						kernelCoarse[k] += coarse[MEDIAN_COARSE * (t + 2 * radius) + k] - coarse[MEDIAN_COARSE * (t - 1) + k];
+				}
+
+				for (k = 0, sum = 0; sum + (int)kernelCoarse[k] <= half; k++)
+					sum += kernelCoarse[k];
+
+				// bring the fine bins of coarse bin k to window t, from scratch when it is far behind
+				bin = MEDIAN_COARSE * k;
+				if (t - updated[k] >= size) {
+					memset(kernelFine + bin, 0, MEDIAN_COARSE * sizeof(unsigned int));
+					for (q = t; q < t + size; q++)
+						for (i = 0; i < MEDIAN_COARSE; i++)
+							kernelFine[bin + i] += fine[MEDIAN_BINS * q + bin + i];
+				}
+				else {
+					for (q = updated[k] + 1; q <= t; q++)
+						for (i = 0; i < MEDIAN_COARSE; i++)
+							kernelFine[bin + i] += fine[MEDIAN_BINS * (q + 2 * radius) + bin + i] - fine[MEDIAN_BINS * (q - 1) + bin + i];
+				}
+				updated[k] = t;
+
+				for (; sum + (int)kernelFine[bin] <= half; bin++)
+					sum += kernelFine[bin];
+				dst[channels * t] = (unsigned char)bin;
+			}
+		}
+	}
+}
+
+// Median of the windows of a tile of 16-bits samples. 65536 bins per column don't fit the cache,
+// so the window histogram is kept alone and moves right by the 2 * radius + 1 samples of a column
+// in and out, in O(radius) per pixel. Its coarse bins of 256 values make the search short.
+static void medianHistogram16(MedianTask *task, const Tile *tile, unsigned int *scratch)
+{
+	const Image *src = task->src;
+	int radius = task->radius, size = 2 * radius + 1, channels = src->channels, half = size * size / 2;
+	int i, j, k, c, t, bin, sum, column;
+	unsigned int *fine = scratch, *coarse = fine + (size_t)src->maxval + 1;
+	const unsigned short *row;
+	unsigned short value, *dst;
+
+	// the histograms are empty between rows, every sample added is taken away at the end
+	for (c = 0; c < channels; c++) {
+		for (j = tile->y0; j < tile->y1; j++) {
+			for (k = -radius; k <= radius; k++) {
+				row = imageSamples16(src, clampIndex(j + k, src->y));
+				for (i = tile->x0 - radius; i <= tile->x0 + radius; i++) {
+					value = row[channels * clampIndex(i, src->x) + c];
+					fine[value]++;
+					coarse[value >> 8]++;
+				}
+			}
+
+			dst = imageSamples16(task->img, j) + c;
+			for (t = tile->x0; t < tile->x1; t++) {
+				if (t > tile->x0) {
+					for (k = -radius; k <= radius; k++) {
+						row = imageSamples16(src, clampIndex(j + k, src->y));
+						value = row[channels * clampIndex(t - radius - 1, src->x) + c];
+						fine[value]--;
+						coarse[value >> 8]--;
+						value = row[channels * clampIndex(t + radius, src->x) + c];
+						fine[value]++;
+						coarse[value >> 8]++;
+					}
+				}
+
+				for (bin = 0, sum = 0; sum + (int)coarse[bin] <= half; bin++)
+					sum += coarse[bin];
+				for (bin <<= 8; sum + (int)fine[bin] <= half; bin++)
+					sum += fine[bin];
+				dst[channels * t] = (unsigned short)bin;
+			}
+
+			for (k = -radius; k <= radius; k++) {
+				row = imageSamples16(src, clampIndex(j + k, src->y));
+				for (i = tile->x1 - 1 - radius; i <= tile->x1 - 1 + radius; i++) {
+					column = clampIndex(i, src->x);
+					fine[row[channels * column + c]]--;
+					coarse[row[channels * column + c] >> 8]--;
+				}
+			}
+		}
+	}
+}
+
+static void tileMedian(void *arg, const Tile *tile, int worker)
+{
+	MedianTask *task = (MedianTask *)arg;
+	unsigned char *scratch = task->scratch + task->scratchSize * worker;
+
+	if (task->radius == 1)
+		(task->img->depth == 1 ? medianNetwork(task, tile, scratch, network9, sizeof(network9) / sizeof(network9[0])) :
+			medianNetwork16(task, tile, (unsigned short *)scratch, network9, sizeof(network9) / sizeof(network9[0])));
+	else if (task->radius == 2)
+		(task->img->depth == 1 ? medianNetwork(task, tile, scratch, network25, sizeof(network25) / sizeof(network25[0])) :
+			medianNetwork16(task, tile, (unsigned short *)scratch, network25, sizeof(network25) / sizeof(network25[0])));
+	else if (task->img->depth == 1)
+		medianHistogram(task, tile, scratch);
+	else
+		medianHistogram16(task, tile, (unsigned int *)scratch);
+}
+
+void filterMedianRadius(Image *img, int radius)
+{
+	MedianTask task;
+	Image *src;
+	size_t padded;
+	int tileHeight, size = 2 * radius + 1;
+
+	if (!img || radius <= 0)
+		return;
+
+	// the tiles overwrite pixels the tiles around them still have to read
+	src = createImage(img->x, img->y, img->channels, img->maxval, img->stride != imageRowSize(img));
+	if (!src) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+	copyImageRect(src, 0, 0, img, 0, 0, img->x, img->y);
+
+	task.img = img;
+	task.src = src;
+	task.radius = radius;
+	tileSize(img, radius, (size_t)img->channels * img->depth * 2, &task.tileWidth, &tileHeight);
+
+	// scratch memory of a tile: the window rows and planes of the networks, the column histograms
+	// of 8-bits samples or the window histogram of 16-bits samples
+	padded = ((size_t)task.tileWidth + 2 * radius) * img->channels;
+	if (radius <= 2)
+		task.scratchSize = (padded * size + (size_t)task.tileWidth * img->channels * size * size) * img->depth;
+	else if (img->depth == 1)
+		task.scratchSize = ((size_t)task.tileWidth + 2 * radius) * (MEDIAN_BINS + MEDIAN_COARSE) * sizeof(unsigned short);
+	else
+		task.scratchSize = ((size_t)img->maxval + 1 + MEDIAN_BINS) * sizeof(unsigned int);
+	task.scratch = (unsigned char *)calloc(parallelThreads(), task.scratchSize);
+	if (!task.scratch) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	tileRun(img, task.tileWidth, tileHeight, tileMedian, &task);
+
+	free(task.scratch);
+	freeImage(src);
+}
+
+void filterMedian(Image *img)
+{
+	filterMedianRadius(img, blurRadius());
+}
@@ -0,0 +1,169 @@
+#include "orient.h"
+#include "parallel.h"
+#include "simd.h"
+#include "tile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// How the pixels of an orientation are found: the new pixel (i, j) is the pixel (i, j) of img, or
+// (j, i) when the sides are swapped, each of them counted from the other side when reversed
+typedef struct {
+	int swap, reverseX, reverseY;
+} OrientMap;
+
+static const OrientMap orientMaps[] = {
+	{ 1, 0, 1 }, // ORIENT_ROTATE_90
+	{ 0, 1, 1 }, // ORIENT_ROTATE_180
+	{ 1, 1, 0 }, // ORIENT_ROTATE_270
+	{ 0, 1, 0 }, // ORIENT_FLIP_HORIZONTAL
+	{ 0, 0, 1 }, // ORIENT_FLIP_VERTICAL
+	{ 1, 0, 0 }, // ORIENT_TRANSPOSE
+	{ 1, 1, 1 } // ORIENT_TRANSVERSE
+};
+
+// Structure for the tiles and rows of an orientation
+typedef struct {
+	const Image *src;
+	Image *dst;
+	OrientMap map;
+	int pixelSize;
+	const SimdKernels *kernels;
+} OrientTask;
+
+// Rows of pixels in the reverse order, for the horizontal mirrors
+#define DEFINE_REVERSE_ROW(name, Sample, CHANNELS) \
+static void name(Sample *dst, const Sample *src, int x) \
+{ \
+	int i, c; \
+\
+	src += (size_t)(x - 1) * CHANNELS; \
+	for (i = 0; i < x; i++, dst += CHANNELS, src -= CHANNELS) \
+		for (c = 0; c < CHANNELS; c++) \
+			dst[c] = src[c]; \
+}
+
+DEFINE_REVERSE_ROW(reverseRowGray, unsigned char, 1)
+DEFINE_REVERSE_ROW(reverseRowRgb, unsigned char, 3)
+DEFINE_REVERSE_ROW(reverseRowGray16, unsigned short, 1)
+DEFINE_REVERSE_ROW(reverseRowRgb16, unsigned short, 3)
+
+static void rangeFlip(void *arg, int start, int end, int worker)
+{
+	OrientTask *task = (OrientTask *)arg;
+	const Image *src = task->src;
+	Image *dst = task->dst;
+	const unsigned char *in;
+	unsigned char *out;
+	int j;
+
+	(void)worker;
+	for (j = start; j < end; j++) {
+		in = imageSamples(src, task->map.reverseY ? src->y - 1 - j : j);
+		out = imageSamples(dst, j);
+		if (!task->map.reverseX)
+			memcpy(out, in, imageRowSize(src));
+		else if (src->depth == 1 && src->channels == 3)
+			reverseRowRgb(out, in, src->x);
+		else if (src->depth == 1)
+			reverseRowGray(out, in, src->x);
+		else if (src->channels == 3)
+			reverseRowRgb16((unsigned short *)out, (const unsigned short *)in, src->x);
+		else
+			reverseRowGray16((unsigned short *)out, (const unsigned short *)in, src->x);
+	}
+}
+
+// Pixels of columns x0 to x1 - 1 and rows y0 to y1 - 1 of a transposed image, one by one
+static void transposePixels(const OrientTask *task, int x0, int y0, int x1, int y1)
+{
+	const Image *src = task->src;
+	int i, j, sx, sy;
+
+	for (j = y0; j < y1; j++) {
+		sx = task->map.reverseX ? src->x - 1 - j : j;
+		for (i = x0; i < x1; i++) {
+			sy = task->map.reverseY ? src->y - 1 - i : i;
+			memcpy(imageSamples(task->dst, j) + (size_t)i * task->pixelSize,
+				imageSamples(src, sy) + (size_t)sx * task->pixelSize, task->pixelSize);
+		}
+	}
+}
+
+// The new row j is the column j of img and the new column i its row i. A block of new rows j to
+// j + 7 and columns i to i + 7 is read from 8 rows of img, walked upwards when the rows are reversed,
+// and written to 8 new rows, walked upwards when the columns are reversed.
+static void tileTranspose(void *arg, const Tile *tile, int worker)
+{
+	OrientTask *task = (OrientTask *)arg;
+	const Image *src = task->src;
+	Image *dst = task->dst;
+	ptrdiff_t srcStride = task->map.reverseY ? -(ptrdiff_t)src->stride : (ptrdiff_t)src->stride;
+	ptrdiff_t dstStride = task->map.reverseX ? -(ptrdiff_t)dst->stride : (ptrdiff_t)dst->stride;
+	int xEnd = tile->x0 + (tile->x1 - tile->x0) / 8 * 8;
+	int yEnd = tile->y0 + (tile->y1 - tile->y0) / 8 * 8;
+	int i, j, sx, sy;
+
+	(void)worker;
+	for (j = tile->y0; j < yEnd; j += 8) {
+		sx = task->map.reverseX ? src->x - 8 - j : j;
+		for (i = tile->x0; i < xEnd; i += 8) {
+			sy = task->map.reverseY ? src->y - 1 - i : i;
+			task->kernels->transpose(imageSamples(dst, task->map.reverseX ? j + 7 : j) + (size_t)i * task->pixelSize,
+				dstStride, imageSamples(src, sy) + (size_t)sx * task->pixelSize, srcStride, task->pixelSize);
+		}
+	}
+
+	// the pixels left past the last whole blocks, at the right and bottom borders
+	transposePixels(task, xEnd, tile->y0, tile->x1, tile->y1);
+	transposePixels(task, tile->x0, yEnd, xEnd, tile->y1);
+}
+
+Image *orientImage(const Image *img, Orientation orientation)
+{
+	OrientTask task;
+	Image *dst;
+
+	if (!img || orientation < ORIENT_ROTATE_90 || orientation > ORIENT_TRANSVERSE)
+		return NULL;
+
+	task.map = orientMaps[orientation];
+	if (task.map.swap)
+		dst = createImage(img->y, img->x, img->channels, img->maxval, 0);
+	else
+		dst = createImage(img->x, img->y, img->channels, img->maxval, 0);
+	if (!dst) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	dst->format = img->format;
+	task.src = img;
+	task.dst = dst;
+	task.pixelSize = img->channels * img->depth;
+	task.kernels = simdKernels();
+	if (task.map.swap)
+		tileRun(dst, ORIENT_TILE, ORIENT_TILE, tileTranspose, &task);
+	else
+		parallelFor(0, dst->y, 0, rangeFlip, &task);
+	return dst;
+}
+
+int findOrientation(const char *name)
+{
+	if (strcmp(name, "rotate90") == 0)
+		return ORIENT_ROTATE_90;
+	if (strcmp(name, "rotate180") == 0)
+		return ORIENT_ROTATE_180;
+	if (strcmp(name, "rotate270") == 0)
+		return ORIENT_ROTATE_270;
+	if (strcmp(name, "mirror") == 0)
+		return ORIENT_FLIP_HORIZONTAL;
+	if (strcmp(name, "flip") == 0)
+		return ORIENT_FLIP_VERTICAL;
+	if (strcmp(name, "transpose") == 0)
+		return ORIENT_TRANSPOSE;
+	if (strcmp(name, "transverse") == 0)
+		return ORIENT_TRANSVERSE;
+	return -1;
+}
@@ -0,0 +1,29 @@
+#ifndef ORIENT_H
+#define ORIENT_H
+
+#include "image.h"
+
+#define ORIENT_TILE 64 // Side of the tiles of the transposing orientations, in pixels
+
+typedef enum {
+	ORIENT_ROTATE_90, // Quarter turn clockwise
+	ORIENT_ROTATE_180, // Half turn
+	ORIENT_ROTATE_270, // Quarter turn counterclockwise
+	ORIENT_FLIP_HORIZONTAL, // Mirror, left and right swapped
+	ORIENT_FLIP_VERTICAL, // Upside down
+	ORIENT_TRANSPOSE, // Mirrored along the diagonal from the top left corner, the rows become the columns
+	ORIENT_TRANSVERSE // Mirrored along the diagonal from the top right corner
+} Orientation;
+
+// Turn or mirror img into a new image, the quarter turns and transpositions swapping its sides.
+// Those read the image by tiles of ORIENT_TILE x ORIENT_TILE pixels, each cut in blocks of 8 x 8
+// pixels turned over in registers, so the rows they read and write stay in the cache. The others
+// copy whole rows, reversing them for the horizontal mirrors. The tiles and rows are split between
+// parallelThreads() threads.
+Image *orientImage(const Image *img, Orientation orientation);
+
+// Orientation of the given name ("rotate90", "rotate180", "rotate270", "mirror", "flip",
+// "transpose" or "transverse"), -1 when there is none
+int findOrientation(const char *name);
+
+#endif
@@ -0,0 +1,408 @@
+#include "platform.h"
+#include "parallel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#define RANGE_DEPTH 64 // Ranges a worker keeps, enough to split any range down to single items
+#define IDLE_SWEEPS 4 // Searches of the other workers an idle worker makes before it sleeps
+
+// Work submitted by a parallelRun(), waiting in the queue until every index has been taken
+typedef struct PoolJob {
+	ParallelTask task;
+	void *arg;
+	int count;
+	int next; // Next index to run
+	int done; // Indexes finished
+	struct PoolJob *following;
+} PoolJob;
+
+// Threads waiting for jobs, and the jobs that still have indexes to hand out
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t work; // Signalled when a job is queued or the threads must stop
+	pthread_cond_t finished; // Signalled when a job is done
+	pthread_t *threads;
+	int size; // Threads of the pool, -1 until it is known
+	int started, stopping;
+	PoolJob *first, *last;
+} pool;
+
+// Ranges waiting in a worker of a parallelFor(). The worker splits its ranges in halves down to the
+// grain, pushing the upper halves at the bottom and taking them back from there, so it works on
+// neighbouring items. Thieves take from the top, where the largest ranges are.
+typedef struct {
+	int starts[RANGE_DEPTH], ends[RANGE_DEPTH];
+	int top, bottom;
+	pthread_mutex_t lock;
+} RangeDeque;
+
+// Structure for the ranges of a parallelFor()
+typedef struct {
+	ParallelRange body;
+	void *arg;
+	int grain, count;
+	int left; // Items not run yet
+	int pushes; // Times ranges were pushed, idle workers sleep until it changes
+	int sleepers; // Idle workers waiting on changed
+	pthread_mutex_t lock;
+	pthread_cond_t changed; // Signalled when ranges are pushed or every item has run
+	RangeDeque *deques; // One per worker
+} ForTask;
+
+static ParallelStats stats;
+static pthread_mutex_t statsLock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_key_t threadsKey;
+static pthread_once_t threadsOnce = PTHREAD_ONCE_INIT;
+
+static void initParallel(void)
+{
+	pthread_key_create(&threadsKey, NULL);
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.work, NULL);
+	pthread_cond_init(&pool.finished, NULL);
+	pool.size = -1;
+}
+
+int poolThreads(void)
+{
+	int threads;
+
+	pthread_once(&threadsOnce, initParallel);
+	pthread_mutex_lock(&pool.lock);
+	if (pool.size < 0)
+		pool.size = hardwareThreads() - 1;
+	threads = pool.size;
+	pthread_mutex_unlock(&pool.lock);
+	return threads;
+}
+
+int parallelThreads(void)
+{
+	int threads;
+
+	pthread_once(&threadsOnce, initParallel);
+	threads = (int)(size_t)pthread_getspecific(threadsKey);
+	return threads > 0 ? threads : poolThreads() + 1;
+}
+
+void setParallelThreads(int threads)
+{
+	pthread_once(&threadsOnce, initParallel);
+	pthread_setspecific(threadsKey, (void *)(size_t)threads);
+}
+
+// Take the next index of job, the lock must be held. The job leaves the queue with its last index.
+static int takeIndex(PoolJob *job)
+{
+	PoolJob **link, *previous = NULL;
+	int index = job->next++;
+
+	if (job->next == job->count) {
+		for (link = &pool.first; *link != job; link = &(*link)->following)
+			previous = *link;
+		*link = job->following;
+		if (pool.last == job)
+			pool.last = previous;
+	}
+	return index;
+}
+
+// Run the index of job taken by takeIndex(), the lock must be held and is held again on return
+static void runIndex(PoolJob *job, int index)
+{
+	pthread_mutex_unlock(&pool.lock);
+	job->task(job->arg, index, job->count);
+	pthread_mutex_lock(&pool.lock);
+
+	if (++job->done == job->count)
+		pthread_cond_broadcast(&pool.finished);
+}
+
+static void *poolWorker(void *unused)
+{
+	PoolJob *job;
+
+	pthread_mutex_lock(&pool.lock);
+	for (;;) {
+		while (!pool.first && !pool.stopping)
+			pthread_cond_wait(&pool.work, &pool.lock);
+		if (pool.stopping)
+			break;
+
+		// the oldest job first, so jobs finish in the order they came
+		job = pool.first;
+		runIndex(job, takeIndex(job));
+	}
+	pthread_mutex_unlock(&pool.lock);
+	return unused;
+}
+
+// Create the threads of the pool, the lock must be held
+static void startPool(void)
+{
+	int t, rc;
+
+	if (pool.size < 0)
+		pool.size = hardwareThreads() - 1;
+	pool.started = 1;
+	if (pool.size == 0)
+		return;
+
+	pool.threads = (pthread_t *)malloc(pool.size * sizeof(pthread_t));
+	if (!pool.threads) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+	for (t = 0; t < pool.size; t++) {
+		rc = pthread_create(&pool.threads[t], NULL, poolWorker, NULL);
+		if (rc) {
+			fprintf(stderr, "ERROR; return code from pthread_create() is %d\n", rc);
+			exit(-1);
+		}
+	}
+}
+
+void setPoolThreads(int threads)
+{
+	int t, rc, size;
+
+	pthread_once(&threadsOnce, initParallel);
+
+	// stop the running threads, the new ones start with the next job
+	pthread_mutex_lock(&pool.lock);
+	size = pool.started ? pool.size : 0;
+	pool.stopping = 1;
+	pthread_cond_broadcast(&pool.work);
+	pthread_mutex_unlock(&pool.lock);
+
+	for (t = 0; t < size; t++) {
+		rc = pthread_join(pool.threads[t], NULL);
+		if (rc) {
+			fprintf(stderr, "ERROR; return code from pthread_join() is %d\n", rc);
+			exit(-1);
+		}
+	}
+
+	pthread_mutex_lock(&pool.lock);
+	free(pool.threads);
+	pool.threads = NULL;
+	pool.started = 0;
+	pool.stopping = 0;
+	pool.size = threads > 0 ? threads : 0;
+	pthread_mutex_unlock(&pool.lock);
+}
+
+void parallelRun(ParallelTask task, void *arg)
+{
+	PoolJob job;
+	int count = parallelThreads();
+
+	// a single thread runs the task itself
+	if (count == 1) {
+		task(arg, 0, 1);
+		return;
+	}
+
+	job.task = task;
+	job.arg = arg;
+	job.count = count;
+	job.next = 0;
+	job.done = 0;
+	job.following = NULL;
+
+	pthread_mutex_lock(&pool.lock);
+	if (!pool.started)
+		startPool();
+	if (pool.last)
+		pool.last->following = &job;
+	else
+		pool.first = &job;
+	pool.last = &job;
+	pthread_cond_broadcast(&pool.work);
+
+	// the submitting thread only runs its own job, so it never waits on the jobs of others.
+	// That keeps nested jobs from waiting on each other as well.
+	while (job.next < job.count)
+		runIndex(&job, takeIndex(&job));
+	while (job.done < job.count)
+		pthread_cond_wait(&pool.finished, &pool.lock);
+	pthread_mutex_unlock(&pool.lock);
+}
+
+// Take the range at the bottom of deque, or at the top for thieves
+static int takeRange(RangeDeque *deque, int thief, int *start, int *end)
+{
+	int found;
+
+	pthread_mutex_lock(&deque->lock);
+	found = deque->bottom > deque->top;
+	if (found && thief) {
+		*start = deque->starts[deque->top];
+		*end = deque->ends[deque->top++];
+	}
+	else if (found) {
+		*start = deque->starts[--deque->bottom];
+		*end = deque->ends[deque->bottom];
+	}
+	if (deque->top == deque->bottom)
+		deque->top = deque->bottom = 0;
+	pthread_mutex_unlock(&deque->lock);
+	return found;
+}
+
+static void threadFor(void *arg, int index, int count)
+{
+	ForTask *task = (ForTask *)arg;
+	RangeDeque *own = &task->deques[index];
+	ParallelStats local = { 0, 0, 0, 0 };
+	double idleStart;
+	int start, end, middle, victim, left, pushed, split, seen, sweeps, found = takeRange(own, 0, &start, &end);
+
+	for (;;) {
+		while (found) {
+			// the upper halves wait in the deque, where idle workers can take them
+			split = 0;
+			while (end - start > task->grain) {
+				middle = start + (end - start) / 2;
+				pthread_mutex_lock(&own->lock);
+				pushed = own->bottom < RANGE_DEPTH;
+				if (pushed) {
+					own->starts[own->bottom] = middle;
+					own->ends[own->bottom++] = end;
+				}
+				pthread_mutex_unlock(&own->lock);
+				if (!pushed)
+					break;
+				end = middle;
+				split = 1;
+			}
+
+			// wake the sleeping workers once for all the halves pushed
+			if (split) {
+				pthread_mutex_lock(&task->lock);
+				task->pushes++;
+				if (task->sleepers)
+					pthread_cond_broadcast(&task->changed);
+				pthread_mutex_unlock(&task->lock);
+			}
+
+			task->body(task->arg, start, end, index);
+			local.ranges++;
+
+			pthread_mutex_lock(&task->lock);
+			task->left -= end - start;
+			if (task->left == 0 && task->sleepers)
+				pthread_cond_broadcast(&task->changed);
+			pthread_mutex_unlock(&task->lock);
+			found = takeRange(own, 0, &start, &end);
+		}
+
+		// out of work, look for some in the other workers until every item has run
+		idleStart = timerSeconds();
+		for (sweeps = 0;; sweeps++) {
+			// ranges pushed after this are either found by the search or change pushes
+			pthread_mutex_lock(&task->lock);
+			left = task->left;
+			seen = task->pushes;
+			pthread_mutex_unlock(&task->lock);
+			if (left == 0)
+				break;
+
+			for (victim = (index + 1) % count; victim != index && !found; victim = (victim + 1) % count)
+				found = takeRange(&task->deques[victim], 1, &start, &end);
+			if (found) {
+				local.steals++;
+				break;
+			}
+			local.failedSteals++;
+
+			// the ranges left are running, some of them may still be split. Spin a few times,
+			// then sleep until one is or until every item has run
+			if (sweeps < IDLE_SWEEPS) {
+				sched_yield();
+				continue;
+			}
+			pthread_mutex_lock(&task->lock);
+			task->sleepers++;
+			while (task->pushes == seen && task->left > 0)
+				pthread_cond_wait(&task->changed, &task->lock);
+			task->sleepers--;
+			pthread_mutex_unlock(&task->lock);
+		}
+		local.idleSeconds += timerSeconds() - idleStart;
+		if (!found)
+			break;
+	}
+
+	pthread_mutex_lock(&statsLock);
+	stats.ranges += local.ranges;
+	stats.steals += local.steals;
+	stats.failedSteals += local.failedSteals;
+	stats.idleSeconds += local.idleSeconds;
+	pthread_mutex_unlock(&statsLock);
+}
+
+void parallelFor(int start, int end, int grain, ParallelRange body, void *arg)
+{
+	ForTask task;
+	int k, count = parallelThreads();
+
+	if (start >= end)
+		return;
+
+	if (grain <= 0) {
+		grain = (end - start) / (8 * count);
+		if (grain < 1)
+			grain = 1;
+	}
+
+	task.body = body;
+	task.arg = arg;
+	task.grain = grain;
+	task.count = count;
+	task.left = end - start;
+	task.pushes = 0;
+	task.sleepers = 0;
+	task.deques = (RangeDeque *)malloc(count * sizeof(RangeDeque));
+	if (!task.deques) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+	pthread_mutex_init(&task.lock, NULL);
+	pthread_cond_init(&task.changed, NULL);
+
+	// every worker starts with an equal share, the workers that finish first take from the others
+	for (k = 0; k < count; k++) {
+		task.deques[k].starts[0] = (int)(start + (long long)(end - start) * k / count);
+		task.deques[k].ends[0] = (int)(start + (long long)(end - start) * (k + 1) / count);
+		task.deques[k].top = 0;
+		task.deques[k].bottom = task.deques[k].ends[0] > task.deques[k].starts[0];
+		pthread_mutex_init(&task.deques[k].lock, NULL);
+	}
+
+	parallelRun(threadFor, &task);
+
+	for (k = 0; k < count; k++)
+		pthread_mutex_destroy(&task.deques[k].lock);
+	pthread_cond_destroy(&task.changed);
+	pthread_mutex_destroy(&task.lock);
+	free(task.deques);
+}
+
+void parallelStats(ParallelStats *counters)
+{
+	pthread_mutex_lock(&statsLock);
+	*counters = stats;
+	pthread_mutex_unlock(&statsLock);
+}
+
+void resetParallelStats(void)
+{
+	pthread_mutex_lock(&statsLock);
+	memset(&stats, 0, sizeof(stats));
+	pthread_mutex_unlock(&statsLock);
+}
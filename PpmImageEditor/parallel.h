@@ -0,0 +1,43 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+// Work run by each thread of parallelRun(), index goes from 0 to count - 1
+typedef void (*ParallelTask)(void *arg, int index, int count);
+
+// Work on the items start to end - 1 of parallelFor(). worker goes from 0 to parallelThreads() - 1
+// and no two ranges run at once with the same worker, so it can index scratch memory.
+typedef void (*ParallelRange)(void *arg, int start, int end, int worker);
+
+// Number of threads the filters split their work in. It is set per calling thread, so
+// threads working on different images at once can share the cores between them.
+// Threads that never set it use the pool threads plus themselves.
+int parallelThreads(void);
+void setParallelThreads(int threads);
+
+// Threads of the pool the work runs on, started on the first parallelRun() and kept until the
+// size changes. The thread submitting work takes part in it, so the pool has hardwareThreads() - 1
+// threads by default and 0 runs everything on the submitting threads. Change it while no filter runs.
+int poolThreads(void);
+void setPoolThreads(int threads);
+
+// Run task parallelThreads() times on the pool and wait for all of them. Several threads can
+// submit work at once, and the tasks can submit work themselves.
+void parallelRun(ParallelTask task, void *arg);
+
+// Counters of the parallelFor() workers since the last reset, to tune grains and thread counts
+typedef struct {
+	unsigned long long ranges; // Ranges run
+	unsigned long long steals; // Ranges taken from another worker
+	unsigned long long failedSteals; // Searches of the other workers that found nothing
+	double idleSeconds; // Time spent looking for work or waiting for it, summed over the workers
+} ParallelStats;
+
+// Run body over the items start to end - 1 in ranges of up to grain items, a grain of 0 makes about
+// 8 ranges per worker. Each worker starts with an equal share and splits it as it goes, the workers
+// running out of work take the largest ranges left from the others, so slow ranges don't hold up the rest.
+void parallelFor(int start, int end, int grain, ParallelRange body, void *arg);
+
+void parallelStats(ParallelStats *counters);
+void resetParallelStats(void);
+
+#endif
@@ -0,0 +1,601 @@
+#include "platform.h"
+#include "pipeline.h"
+#include "parallel.h"
+#include "tile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// Step of a planned run, a composed point chain or a neighbourhood filter
+typedef struct {
+	PointChain *chain;
+	const PipelineStage *stage;
+} PipelineStep;
+
+// Structure for the tiles of a run of neighbourhood filters
+typedef struct {
+	const Image *src;
+	Image *dst;
+	const PipelineStep *steps;
+	int count;
+	int halo; // Halo of the whole run, the sum of the halos of its filters
+	Image **regions; // Buffer of a tile and its halo per worker
+} SegmentTask;
+
+Pipeline *createPipeline(void)
+{
+	Pipeline *pipeline;
+
+	pipeline = (Pipeline *)calloc(1, sizeof(Pipeline));
+	if (!pipeline) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+	return pipeline;
+}
+
+void freePipeline(Pipeline *pipeline)
+{
+	if (!pipeline)
+		return;
+
+	free(pipeline->stages);
+	free(pipeline);
+}
+
+static PipelineStage *addStage(Pipeline *pipeline, StageKind kind)
+{
+	PipelineStage *stage;
+
+	if (pipeline->count == pipeline->size) {
+		pipeline->size = pipeline->size ? 2 * pipeline->size : 8;
+		pipeline->stages = (PipelineStage *)realloc(pipeline->stages, pipeline->size * sizeof(PipelineStage));
+		if (!pipeline->stages) {
+			fprintf(stderr, "Unable to allocate memory\n");
+			exit(1);
+		}
+	}
+	stage = &pipeline->stages[pipeline->count++];
+	memset(stage, 0, sizeof(PipelineStage));
+	stage->kind = kind;
+	return stage;
+}
+
+void pipelinePoint(Pipeline *pipeline, PointOperation operation, int channel, double a, double b)
+{
+	PipelineStage *stage = addStage(pipeline, STAGE_POINT);
+
+	stage->operation = operation;
+	stage->channel = channel;
+	stage->a = a;
+	stage->b = b;
+}
+
+void pipelineNeighbourhood(Pipeline *pipeline, StageFilter filter, double parameter, int halo)
+{
+	PipelineStage *stage = addStage(pipeline, STAGE_NEIGHBOURHOOD);
+
+	stage->neighbourhood = filter;
+	stage->parameter = parameter;
+	stage->halo = halo;
+}
+
+void pipelineFilter(Pipeline *pipeline, FilterFunction filter)
+{
+	addStage(pipeline, STAGE_IMAGE)->filter = filter;
+}
+
+void pipelineResize(Pipeline *pipeline, int width, int height, ResizeFilter filter)
+{
+	PipelineStage *stage = addStage(pipeline, STAGE_RESIZE);
+
+	stage->width = width;
+	stage->height = height;
+	stage->resize = filter;
+}
+
+void pipelineOrient(Pipeline *pipeline, Orientation orientation)
+{
+	addStage(pipeline, STAGE_ORIENT)->orientation = orientation;
+}
+
+void pipelineCrop(Pipeline *pipeline, int x0, int y0, int width, int height)
+{
+	PipelineStage *stage = addStage(pipeline, STAGE_CROP);
+
+	stage->x0 = x0;
+	stage->y0 = y0;
+	stage->width = width;
+	stage->height = height;
+}
+
+static void gaussianStage(Image *img, double sigma)
+{
+	filterGaussianBlurSigma(img, sigma);
+}
+
+static void fastGaussianStage(Image *img, double sigma)
+{
+	filterFastGaussianBlurSigma(img, sigma);
+}
+
+static void boxStage(Image *img, double radius)
+{
+	filterBoxBlurRadius(img, (int)radius);
+}
+
+static void meanStage(Image *img, double radius)
+{
+	filterMeanBlurPasses(img, (int)radius, 1);
+}
+
+static void medianStage(Image *img, double radius)
+{
+	filterMedianRadius(img, (int)radius);
+}
+
+void pipelineGaussianBlur(Pipeline *pipeline, double sigma)
+{
+	pipelineNeighbourhood(pipeline, gaussianStage, sigma, (int)ceil(3 * sigma));
+}
+
+void pipelineFastGaussianBlur(Pipeline *pipeline, double sigma)
+{
+	// every box is at most half the ideal width plus one, see filterFastGaussianBlurSigma()
+	double ideal = sqrt(12 * sigma * sigma / BOX_PASSES + 1);
+
+	pipelineNeighbourhood(pipeline, fastGaussianStage, sigma, BOX_PASSES * ((int)ideal / 2 + 1));
+}
+
+void pipelineBoxBlur(Pipeline *pipeline, int radius)
+{
+	pipelineNeighbourhood(pipeline, boxStage, radius, radius);
+}
+
+void pipelineMeanBlur(Pipeline *pipeline, int radius)
+{
+	pipelineNeighbourhood(pipeline, meanStage, radius, radius);
+}
+
+void pipelineMedian(Pipeline *pipeline, int radius)
+{
+	pipelineNeighbourhood(pipeline, medianStage, radius, radius);
+}
+
+// Parameters of a point operation name, "a" or "a:b" after the prefix. Returns 0 when they don't parse.
+static int pointParameters(const char *text, int count, double *a, double *b)
+{
+	char *end;
+
+	*a = strtod(text, &end);
+	if (end == text)
+		return 0;
+	if (count == 2) {
+		if (*end != ':')
+			return 0;
+		text = end + 1;
+		*b = strtod(text, &end);
+		if (end == text)
+			return 0;
+	}
+	return *end == '\0';
+}
+
+// Size and filter of a resize name, "WxH" or "WxH:filter" after the prefix. Returns 0 when they don't parse.
+static int resizeParameters(const char *text, int *width, int *height, int *filter)
+{
+	char *end;
+
+	*width = (int)strtol(text, &end, 10);
+	if (end == text || *end != 'x')
+		return 0;
+	text = end + 1;
+	*height = (int)strtol(text, &end, 10);
+	if (end == text || *width < 0 || *height < 0 || (*width == 0 && *height == 0))
+		return 0;
+	*filter = *end == ':' ? findResizeFilter(end + 1) : *end == '\0' ? RESIZE_LANCZOS : -1;
+	return *filter >= 0;
+}
+
+// Parse "WxH+X+Y", returns 0 when it is invalid
+static int cropParameters(const char *text, int *x0, int *y0, int *width, int *height)
+{
+	char *end;
+
+	*width = (int)strtol(text, &end, 10);
+	if (end == text || *end != 'x')
+		return 0;
+	text = end + 1;
+	*height = (int)strtol(text, &end, 10);
+	if (end == text || *end != '+')
+		return 0;
+	text = end + 1;
+	*x0 = (int)strtol(text, &end, 10);
+	if (end == text || *end != '+')
+		return 0;
+	text = end + 1;
+	*y0 = (int)strtol(text, &end, 10);
+	return end != text && *end == '\0' && *width > 0 && *height > 0 && *x0 >= 0 && *y0 >= 0;
+}
+
+int pipelineAdd(Pipeline *pipeline, const char *name)
+{
+	static const struct {
+		const char *prefix;
+		PointOperation operation;
+		int count;
+	} points[] = {
+		{ "brightness=", POINT_BRIGHTNESS, 1 },
+		{ "contrast=", POINT_CONTRAST, 1 },
+		{ "gamma=", POINT_GAMMA, 1 },
+		{ "levels=", POINT_LEVELS, 2 },
+		{ "threshold=", POINT_THRESHOLD, 1 }
+	};
+	FilterFunction filter;
+	double a, b = 0;
+	size_t length;
+	int k, x0, y0, width, height, resize;
+
+	for (k = 0; k < (int)(sizeof(points) / sizeof(points[0])); k++) {
+		length = strlen(points[k].prefix);
+		if (strncmp(name, points[k].prefix, length) == 0) {
+			if (!pointParameters(name + length, points[k].count, &a, &b))
+				return 0;
+			pipelinePoint(pipeline, points[k].operation, POINT_ALL_CHANNELS, a, b);
+			return 1;
+		}
+	}
+
+	if (strncmp(name, "resize=", 7) == 0) {
+		if (!resizeParameters(name + 7, &width, &height, &resize))
+			return 0;
+		pipelineResize(pipeline, width, height, (ResizeFilter)resize);
+		return 1;
+	}
+	if (strncmp(name, "crop=", 5) == 0) {
+		if (!cropParameters(name + 5, &x0, &y0, &width, &height))
+			return 0;
+		pipelineCrop(pipeline, x0, y0, width, height);
+		return 1;
+	}
+	if (findOrientation(name) >= 0) {
+		pipelineOrient(pipeline, (Orientation)findOrientation(name));
+		return 1;
+	}
+
+	// the filters of findFilter() that only read a neighbourhood become tiled stages
+	if (strcmp(name, "invert") == 0)
+		pipelinePoint(pipeline, POINT_INVERT, POINT_ALL_CHANNELS, 0, 0);
+	else if (strcmp(name, "blur") == 0)
+		pipelineGaussianBlur(pipeline, blurSigma());
+	else if (strcmp(name, "fastblur") == 0)
+		pipelineFastGaussianBlur(pipeline, blurSigma());
+	else if (strcmp(name, "box") == 0)
+		pipelineBoxBlur(pipeline, blurRadius());
+	else if (strcmp(name, "mean") == 0)
+		pipelineMeanBlur(pipeline, blurRadius());
+	else if (strcmp(name, "median") == 0)
+		pipelineMedian(pipeline, blurRadius());
+	else {
+		filter = findFilter(name);
+		if (!filter)
+			return 0;
+		pipelineFilter(pipeline, filter);
+	}
+	return 1;
+}
+
+static void segmentTile(void *arg, const Tile *tile, int worker)
+{
+	SegmentTask *task = (SegmentTask *)arg;
+	const Image *src = task->src;
+	Image region;
+	int x0, y0, x1, y1, k, threads;
+
+	// the tile with the halo of every filter, cut at the borders where the filters repeat the border
+	// pixels themselves, so the filters see the same pixels around the tile as on the whole image
+	x0 = tile->x0 - task->halo > 0 ? tile->x0 - task->halo : 0;
+	y0 = tile->y0 - task->halo > 0 ? tile->y0 - task->halo : 0;
+	x1 = tile->x1 + task->halo < src->x ? tile->x1 + task->halo : src->x;
+	y1 = tile->y1 + task->halo < src->y ? tile->y1 + task->halo : src->y;
+
+	// a view of the buffer of the worker, sized to the tile
+	region = *task->regions[worker];
+	region.x = x1 - x0;
+	region.y = y1 - y0;
+	region.parent = task->regions[worker];
+	region.references = 0;
+	copyImageRect(&region, 0, 0, src, x0, y0, x1 - x0, y1 - y0);
+
+	// the tiles are already spread over the threads, the filters run on this one
+	threads = parallelThreads();
+	setParallelThreads(1);
+	for (k = 0; k < task->count; k++) {
+		if (task->steps[k].chain)
+			applyPointChain(task->steps[k].chain, &region);
+		else
+			task->steps[k].stage->neighbourhood(&region, task->steps[k].stage->parameter);
+	}
+	setParallelThreads(threads);
+
+	copyImageRect(task->dst, tile->x0, tile->y0, &region, tile->x0 - x0, tile->y0 - y0,
+		tile->x1 - tile->x0, tile->y1 - tile->y0);
+}
+
+// Nonzero when img holds width x height pixels of the format given, so it can be reused for them
+static int imageFits(const Image *img, int width, int height, int channels, int maxval)
+{
+	return img && img->x >= width && img->y >= height && img->channels == channels && img->maxval == maxval;
+}
+
+// Image of the size and format of img from the spare of scratch, or a new one
+static Image *takeSpare(PipelineScratch *scratch, const Image *img)
+{
+	Image *dst = scratch->spare;
+
+	scratch->spare = NULL;
+	if (dst && (dst->x != img->x || dst->y != img->y || dst->channels != img->channels || dst->maxval != img->maxval)) {
+		freeImage(dst);
+		dst = NULL;
+	}
+	if (!dst)
+		dst = createImage(img->x, img->y, img->channels, img->maxval, 0);
+	if (!dst) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+	return dst;
+}
+
+// Make sure scratch holds a width x height buffer in the format of img for each of workers
+static void reserveRegions(PipelineScratch *scratch, const Image *img, int width, int height, int workers)
+{
+	int k;
+
+	if (workers > scratch->regionCount) {
+		scratch->regions = (Image **)realloc(scratch->regions, workers * sizeof(Image *));
+		if (!scratch->regions) {
+			fprintf(stderr, "Unable to allocate memory\n");
+			exit(1);
+		}
+		for (k = scratch->regionCount; k < workers; k++)
+			scratch->regions[k] = NULL;
+		scratch->regionCount = workers;
+	}
+
+	for (k = 0; k < workers; k++) {
+		if (imageFits(scratch->regions[k], width, height, img->channels, img->maxval))
+			continue;
+		freeImage(scratch->regions[k]);
+		scratch->regions[k] = createImage(width, height, img->channels, img->maxval, 0);
+		if (!scratch->regions[k]) {
+			fprintf(stderr, "Unable to allocate memory\n");
+			exit(1);
+		}
+	}
+}
+
+void freePipelineScratch(PipelineScratch *scratch)
+{
+	int k;
+
+	for (k = 0; k < scratch->regionCount; k++)
+		freeImage(scratch->regions[k]);
+	free(scratch->regions);
+	freeImage(scratch->spare);
+	memset(scratch, 0, sizeof(PipelineScratch));
+}
+
+// Run count point and neighbourhood stages on img, returns the result
+static Image *runSegment(const PipelineStage *stages, int count, Image *img, PipelineScratch *scratch)
+{
+	PipelineStep *steps;
+	SegmentTask task;
+	Image *dst;
+	int k, stepCount = 0, halo = 0, tileWidth, tileHeight, width, height;
+
+	steps = (PipelineStep *)malloc(count * sizeof(PipelineStep));
+	if (!steps) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	// the point operations next to each other compose into a single chain
+	for (k = 0; k < count; k++) {
+		if (stages[k].kind == STAGE_POINT) {
+			if (stepCount == 0 || !steps[stepCount - 1].chain) {
+				steps[stepCount].chain = createPointChain(img->channels, img->maxval);
+				steps[stepCount].stage = NULL;
+				stepCount++;
+			}
+			addPointOperation(steps[stepCount - 1].chain, stages[k].operation, stages[k].channel, stages[k].a, stages[k].b);
+		}
+		else {
+			steps[stepCount].chain = NULL;
+			steps[stepCount].stage = &stages[k];
+			stepCount++;
+			halo += stages[k].halo;
+		}
+	}
+
+	// a lone chain changes each pixel on its own, in place
+	if (stepCount == 1 && steps[0].chain) {
+		applyPointChain(steps[0].chain, img);
+		freePointChain(steps[0].chain);
+		free(steps);
+		return img;
+	}
+
+	dst = takeSpare(scratch, img);
+	dst->format = img->format;
+
+	task.src = img;
+	task.dst = dst;
+	task.steps = steps;
+	task.count = stepCount;
+	task.halo = halo;
+	// the filters cut their image in tiles themselves, a tile and its halo take a single one of them
+	// rather than one and a narrow column of what is left
+	tileSize(img, halo, (size_t)img->channels * img->depth * PIPELINE_BUFFERS, &tileWidth, &tileHeight);
+	if (tileWidth + 2 * halo > TILE_MAX_WIDTH && 4 * halo < TILE_MAX_WIDTH)
+		tileWidth = TILE_MAX_WIDTH - 2 * halo;
+
+	// the tiles with their halos are filtered in buffers kept from one segment to the next
+	width = tileWidth + 2 * halo < img->x ? tileWidth + 2 * halo : img->x;
+	height = tileHeight + 2 * halo < img->y ? tileHeight + 2 * halo : img->y;
+	reserveRegions(scratch, img, width, height, parallelThreads());
+	task.regions = scratch->regions;
+	tileRun(dst, tileWidth, tileHeight, segmentTile, &task);
+
+	for (k = 0; k < stepCount; k++)
+		freePointChain(steps[k].chain);
+	free(steps);
+
+	// a view stays in its owner, otherwise the replaced image is kept for the next segment
+	if (img->parent) {
+		copyImageRect(img, 0, 0, dst, 0, 0, dst->x, dst->y);
+		scratch->spare = dst;
+		return img;
+	}
+	// views of img still need its pixels
+	if (img->references == 1)
+		scratch->spare = img;
+	else
+		freeImage(img);
+	return dst;
+}
+
+// Size of an image of x * y pixels resized by stage, in place
+static void resizedSize(const PipelineStage *stage, int *x, int *y)
+{
+	int width = stage->width, height = stage->height;
+
+	// the missing side keeps the aspect ratio
+	if (width == 0)
+		width = (int)((long long)*x * height * 2 / *y + 1) / 2;
+	if (height == 0)
+		height = (int)((long long)*y * width * 2 / *x + 1) / 2;
+	*x = width > 0 ? width : 1;
+	*y = height > 0 ? height : 1;
+}
+
+// Resize img as stage says, returns the new image
+static Image *runResize(const PipelineStage *stage, Image *img)
+{
+	Image *resized;
+	int width = img->x, height = img->y;
+
+	resizedSize(stage, &width, &height);
+	resized = resizeImage(img, width, height, stage->resize);
+	if (!resized) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+	freeImage(img);
+	return resized;
+}
+
+// Turn img as stage says, returns the new image
+static Image *runOrient(const PipelineStage *stage, Image *img)
+{
+	Image *turned = orientImage(img, stage->orientation);
+
+	freeImage(img);
+	return turned;
+}
+
+// View of the rectangle of stage cut to img, img is released
+static Image *runCrop(const PipelineStage *stage, Image *img)
+{
+	Image *view;
+	int width = stage->width < img->x - stage->x0 ? stage->width : img->x - stage->x0;
+	int height = stage->height < img->y - stage->y0 ? stage->height : img->y - stage->y0;
+
+	if (stage->x0 >= img->x || stage->y0 >= img->y) {
+		fprintf(stderr, "Crop at %d,%d outside of the %dx%d image\n", stage->x0, stage->y0, img->x, img->y);
+		exit(1);
+	}
+
+	view = createImageView(img, stage->x0, stage->y0, width, height);
+	if (!view) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+	freeImage(img);
+	return view;
+}
+
+int pipelineImageSize(const Pipeline *pipeline, int *x, int *y)
+{
+	const PipelineStage *stage;
+	int k, side;
+
+	for (k = 0; k < pipeline->count; k++) {
+		stage = &pipeline->stages[k];
+		if (stage->kind == STAGE_RESIZE)
+			resizedSize(stage, x, y);
+		else if (stage->kind == STAGE_ORIENT && stage->orientation != ORIENT_ROTATE_180 &&
+			stage->orientation != ORIENT_FLIP_HORIZONTAL && stage->orientation != ORIENT_FLIP_VERTICAL) {
+			side = *x;
+			*x = *y;
+			*y = side;
+		}
+		else if (stage->kind == STAGE_CROP) {
+			if (stage->x0 >= *x || stage->y0 >= *y)
+				return 0;
+			*x = stage->width < *x - stage->x0 ? stage->width : *x - stage->x0;
+			*y = stage->height < *y - stage->y0 ? stage->height : *y - stage->y0;
+		}
+	}
+	return 1;
+}
+
+Image *runPipeline(const Pipeline *pipeline, Image *img)
+{
+	PipelineScratch scratch;
+
+	memset(&scratch, 0, sizeof(scratch));
+	img = runPipelineScratch(pipeline, img, &scratch);
+	freePipelineScratch(&scratch);
+	return img;
+}
+
+Image *runPipelineScratch(const Pipeline *pipeline, Image *img, PipelineScratch *scratch)
+{
+	int start = 0, end;
+
+	if (!img)
+		return NULL;
+
+	while (start < pipeline->count) {
+		if (pipeline->stages[start].kind == STAGE_IMAGE) {
+			pipeline->stages[start].filter(img);
+			start++;
+			continue;
+		}
+		if (pipeline->stages[start].kind == STAGE_RESIZE) {
+			img = runResize(&pipeline->stages[start], img);
+			start++;
+			continue;
+		}
+		if (pipeline->stages[start].kind == STAGE_CROP) {
+			img = runCrop(&pipeline->stages[start], img);
+			start++;
+			continue;
+		}
+		if (pipeline->stages[start].kind == STAGE_ORIENT) {
+			img = runOrient(&pipeline->stages[start], img);
+			start++;
+			continue;
+		}
+
+		// the stages up to the next whole image filter, resize or rotation run together
+		for (end = start; end < pipeline->count && (pipeline->stages[end].kind == STAGE_POINT ||
+			pipeline->stages[end].kind == STAGE_NEIGHBOURHOOD); end++)
+			;
+		img = runSegment(pipeline->stages + start, end - start, img, scratch);
+		start = end;
+	}
+	return img;
+}
@@ -0,0 +1,112 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "image.h"
+#include "filters.h"
+#include "pointops.h"
+#include "resize.h"
+#include "orient.h"
+
+#define PIPELINE_BUFFERS 4 // Copies of a tile and its halo the neighbourhood filters keep at once, to size the tiles
+
+// Neighbourhood filter of a pipeline, run on a tile with its halo as if it was a whole image
+typedef void (*StageFilter)(Image *img, double parameter);
+
+typedef enum {
+	STAGE_POINT, // Point operation, composed with the point operations next to it
+	STAGE_NEIGHBOURHOOD, // Filter reading the pixels up to halo pixels away, run tile by tile
+	STAGE_IMAGE, // Filter of the whole image, run on its own
+	STAGE_RESIZE, // Resize to a new image, run on its own
+	STAGE_ORIENT, // Rotation or mirror to a new image, run on its own
+	STAGE_CROP // View of a rectangle of the image, nothing is copied
+} StageKind;
+
+// Step of a pipeline, a point operation or a filter
+typedef struct {
+	StageKind kind;
+	PointOperation operation; // Point operations
+	int channel;
+	double a, b;
+	StageFilter neighbourhood; // Neighbourhood filters
+	double parameter;
+	int halo;
+	FilterFunction filter; // Whole image filters
+	int width, height; // Resizes, 0 for the side following the aspect ratio, and crops
+	int x0, y0; // Crops, the top left corner of the rectangle
+	ResizeFilter resize;
+	Orientation orientation; // Rotations and mirrors
+} PipelineStage;
+
+// Filters to run on an image one after the other. Nothing runs while they are added, runPipeline()
+// plans the whole chain first: the point operations next to each other become one lookup table, and
+// the neighbourhood filters between two whole image filters, resizes or rotations run together tile by tile.
+// Each tile is copied with the halo all of them need, filtered by every stage while it is in the
+// cache and copied to the result, so the image is read and written once for all of them. The halos
+// are computed by the tiles that share them, and the filters repeat the border pixels, so the result
+// is the one of the filters run one after the other on the whole image.
+typedef struct {
+	PipelineStage *stages;
+	int count, size;
+} Pipeline;
+
+Pipeline *createPipeline(void);
+void freePipeline(Pipeline *pipeline);
+
+// Add a point operation, see addPointOperation()
+void pipelinePoint(Pipeline *pipeline, PointOperation operation, int channel, double a, double b);
+
+// Add a neighbourhood filter, whose pixels depend on the pixels up to halo pixels away from them.
+// Past the borders of the image it must repeat the border pixels or leave them out of its windows.
+void pipelineNeighbourhood(Pipeline *pipeline, StageFilter filter, double parameter, int halo);
+
+// Add the neighbourhood filters of filters.h
+void pipelineGaussianBlur(Pipeline *pipeline, double sigma);
+void pipelineFastGaussianBlur(Pipeline *pipeline, double sigma);
+void pipelineBoxBlur(Pipeline *pipeline, int radius);
+void pipelineMeanBlur(Pipeline *pipeline, int radius);
+void pipelineMedian(Pipeline *pipeline, int radius);
+
+// Add a filter working on the whole image, the stages before it are finished when it runs
+void pipelineFilter(Pipeline *pipeline, FilterFunction filter);
+
+// Add a resize to width x height pixels, one of them may be 0 to keep the aspect ratio
+void pipelineResize(Pipeline *pipeline, int width, int height, ResizeFilter filter);
+
+// Add a rotation or mirror, see orientImage()
+void pipelineOrient(Pipeline *pipeline, Orientation orientation);
+
+// Add a crop to the width x height pixels at (x0, y0), cut to the image. The stages after it work
+// on a view of the rectangle, see createImageView(), so cropping copies nothing. (x0, y0) must be
+// in the image, runPipeline() exits otherwise, pipelineImageSize() checks it beforehand.
+void pipelineCrop(Pipeline *pipeline, int x0, int y0, int width, int height);
+
+// Add a filter by name: the names of findFilter(), with the current sigma and radius, the point
+// operations "brightness=a", "contrast=a", "gamma=a", "levels=a:b" and "threshold=a", and
+// "resize=WxH" or "resize=WxH:filter" with the names of findResizeFilter(), lanczos by default,
+// the names of findOrientation() and "crop=WxH+X+Y". Returns 0 when the name is unknown.
+int pipelineAdd(Pipeline *pipeline, const char *name);
+
+// Size of the image the pipeline makes of an image of *x by *y pixels, in place.
+// Returns 0 when a crop starts outside of the image it cuts.
+int pipelineImageSize(const Pipeline *pipeline, int *x, int *y);
+
+// Buffers a pipeline reuses from an image to the next, for streams of frames of the same size.
+// A scratch serves one thread at a time, it starts zeroed and is released with freePipelineScratch().
+typedef struct {
+	Image *spare; // Image replaced by the output of a segment, the output of the next segment of its size
+	Image **regions; // Tile with its halo, one per worker
+	int regionCount;
+} PipelineScratch;
+
+void freePipelineScratch(PipelineScratch *scratch);
+
+// Run the pipeline on img. Returns the filtered image, img itself or a new image when img was freed.
+// A view keeps its place in its owner until a stage changes its size: the filters write its pixels
+// of the owner, so a rectangle of an image is filtered in place.
+Image *runPipeline(const Pipeline *pipeline, Image *img);
+
+// runPipeline() keeping its buffers in scratch: an image a segment replaces is kept there rather than
+// freed and becomes the output of the next segment, so frames of the same size allocate nothing.
+Image *runPipelineScratch(const Pipeline *pipeline, Image *img, PipelineScratch *scratch);
+
+#endif
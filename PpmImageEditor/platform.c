@@ -0,0 +1,314 @@
+#include "platform.h"
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#include <malloc.h>
+#include <io.h>
+#include <fcntl.h>
+#include <share.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#endif
+
+void *alignedAlloc(size_t size, size_t alignment)
+{
+#ifdef _WIN32
+	return _aligned_malloc(size, alignment);
+#else
+	void *p;
+	if (posix_memalign(&p, alignment, size) != 0)
+		return NULL;
+	return p;
+#endif
+}
+
+void alignedFree(void *p)
+{
+#ifdef _WIN32
+	_aligned_free(p);
+#else
+	free(p);
+#endif
+}
+
+void bigEndianSamples(unsigned short *samples, size_t count)
+{
+#ifndef HOST_BIG_ENDIAN
+	size_t k = 0;
+
+#ifdef HAVE_SSE2
+	// swap 8 samples at a time
+	for (; k + 8 <= count; k += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(samples + k));
+		_mm_storeu_si128((__m128i *)(samples + k), _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8)));
+	}
+#endif
+	for (; k < count; k++)
+		samples[k] = (unsigned short)((samples[k] << 8) | (samples[k] >> 8));
+#else
+	(void)samples;
+	(void)count;
+#endif
+}
+
+void setBinaryMode(FILE *fp)
+{
+#ifdef _WIN32
+	_setmode(_fileno(fp), _O_BINARY);
+#else
+	(void)fp;
+#endif
+}
+
+int hardwareThreads(void)
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+#else
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (int)count : 1;
+#endif
+}
+
+size_t cacheSizeL2(void)
+{
+#ifdef _WIN32
+	SYSTEM_LOGICAL_PROCESSOR_INFORMATION *info;
+	DWORD length = 0, k;
+	size_t size = 0;
+
+	GetLogicalProcessorInformation(NULL, &length);
+	info = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION *)malloc(length);
+	if (info && GetLogicalProcessorInformation(info, &length)) {
+		for (k = 0; k < length / sizeof(*info); k++)
+			if (info[k].Relationship == RelationCache && info[k].Cache.Level == 2)
+				size = info[k].Cache.Size;
+	}
+	free(info);
+	return size ? size : DEFAULT_L2_SIZE;
+#elif defined(_SC_LEVEL2_CACHE_SIZE)
+	long size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+	return size > 0 ? (size_t)size : DEFAULT_L2_SIZE;
+#else
+	return DEFAULT_L2_SIZE;
+#endif
+}
+
+double timerSeconds(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER counter, frequency;
+	QueryPerformanceCounter(&counter);
+	QueryPerformanceFrequency(&frequency);
+	return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec + now.tv_nsec * 1e-9;
+#endif
+}
+
+int isDirectory(const char *path)
+{
+#ifdef _WIN32
+	DWORD attributes = GetFileAttributes(path);
+	return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+#else
+	struct stat st;
+	return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+#endif
+}
+
+// Append "dir/name" to the list of paths
+static void addPath(char ***paths, int *count, int *size, const char *dir, const char *name)
+{
+	size_t dirLength = strlen(dir), nameLength = strlen(name);
+	char *path;
+
+	if (*count == *size) {
+		*size = *size ? 2 * *size : 16;
+		*paths = (char **)realloc(*paths, *size * sizeof(char *));
+	}
+	path = (char *)malloc(dirLength + nameLength + 2);
+	if (!*paths || !path) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	memcpy(path, dir, dirLength);
+	path[dirLength] = '/';
+	memcpy(path + dirLength + 1, name, nameLength + 1);
+	(*paths)[(*count)++] = path;
+}
+
+char **listDirectory(const char *dir, int *count)
+{
+	char **paths = NULL;
+	int size = 0;
+#ifdef _WIN32
+	WIN32_FIND_DATA data;
+	HANDLE find;
+	char pattern[MAX_PATH];
+	size_t length = strlen(dir);
+
+	*count = 0;
+	if (length + 3 > sizeof(pattern))
+		return NULL;
+	memcpy(pattern, dir, length);
+	memcpy(pattern + length, "/*", 3);
+
+	find = FindFirstFile(pattern, &data);
+	if (find == INVALID_HANDLE_VALUE)
+		return NULL;
+	do {
+		if (!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+			addPath(&paths, count, &size, dir, data.cFileName);
+	} while (FindNextFile(find, &data));
+	FindClose(find);
+#else
+	DIR *d;
+	struct dirent *entry;
+
+	*count = 0;
+	d = opendir(dir);
+	if (!d)
+		return NULL;
+	while ((entry = readdir(d)) != NULL) {
+		if (entry->d_name[0] == '.')
+			continue;
+		addPath(&paths, count, &size, dir, entry->d_name);
+	}
+	closedir(d);
+#endif
+	return paths;
+}
+
+FILE *createNewFile(const char *filename)
+{
+	FILE *fp;
+	int fd;
+
+#ifdef _WIN32
+	if (_sopen_s(&fd, filename, _O_WRONLY | _O_CREAT | _O_EXCL | _O_BINARY, _SH_DENYWR, _S_IREAD | _S_IWRITE) != 0)
+		return NULL;
+	fp = _fdopen(fd, "wb");
+	if (!fp)
+		_close(fd);
+#else
+	fd = open(filename, O_WRONLY | O_CREAT | O_EXCL, 0666);
+	if (fd < 0)
+		return NULL;
+	fp = fdopen(fd, "wb");
+	if (!fp)
+		close(fd);
+#endif
+	return fp;
+}
+
+void preallocateFile(FILE *fp, unsigned long long size)
+{
+#ifdef _WIN32
+	FILE_ALLOCATION_INFO info;
+
+	info.AllocationSize.QuadPart = (LONGLONG)size;
+	SetFileInformationByHandle((HANDLE)_get_osfhandle(_fileno(fp)), FileAllocationInfo, &info, sizeof(info));
+#elif defined(__linux__)
+	posix_fallocate(fileno(fp), 0, (off_t)size);
+#else
+	(void)fp;
+	(void)size;
+#endif
+}
+
+int syncFile(FILE *fp)
+{
+	if (fflush(fp) != 0)
+		return -1;
+#ifdef _WIN32
+	return FlushFileBuffers((HANDLE)_get_osfhandle(_fileno(fp))) ? 0 : -1;
+#else
+	return fsync(fileno(fp));
+#endif
+}
+
+int replaceFile(const char *source, const char *target)
+{
+#ifdef _WIN32
+	return MoveFileEx(source, target, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) ? 0 : -1;
+#else
+	return rename(source, target);
+#endif
+}
+
+void *mapFile(const char *filename, int copyOnWrite, size_t *size)
+{
+#ifdef _WIN32
+	HANDLE file, mapping;
+	LARGE_INTEGER fileSize;
+	void *view;
+
+	file = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return NULL;
+
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0 || (unsigned long long)fileSize.QuadPart > (size_t)-1) {
+		CloseHandle(file);
+		return NULL;
+	}
+
+	mapping = CreateFileMapping(file, NULL, copyOnWrite ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL);
+	view = mapping ? MapViewOfFile(mapping, copyOnWrite ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0) : NULL;
+
+	// the view keeps the file mapped, the handles are not needed anymore
+	if (mapping)
+		CloseHandle(mapping);
+	CloseHandle(file);
+
+	*size = (size_t)fileSize.QuadPart;
+	return view;
+#else
+	struct stat st;
+	void *view;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return NULL;
+	}
+
+	view = mmap(NULL, (size_t)st.st_size, copyOnWrite ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (view == MAP_FAILED)
+		return NULL;
+
+	*size = (size_t)st.st_size;
+	return view;
+#endif
+}
+
+void unmapFile(void *view, size_t size)
+{
+#ifdef _WIN32
+	(void)size;
+	UnmapViewOfFile(view);
+#else
+	munmap(view, size);
+#endif
+}
@@ -0,0 +1,95 @@
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+// Small portability layer so the image code builds with MSVC and with gcc/clang
+#include <stdio.h>
+#include <stddef.h>
+#include <errno.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define INLINE __inline
+#else
+#define INLINE inline
+typedef int errno_t;
+#define fopen_s(fp, name, mode) ((*(fp) = fopen(name, mode)) ? 0 : errno)
+#define fscanf_s fscanf
+#endif
+
+// SSE2 is part of every x64 target and the default of 32 bits MSVC builds
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HAVE_SSE2 1
+#endif
+
+// Byte order of the host, MSVC only targets little-endian machines
+#if defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define HOST_BIG_ENDIAN 1
+#endif
+
+// Index of the lowest set bit, value must not be 0
+static INLINE int countTrailingZeros(unsigned int value)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, value);
+	return (int)index;
+#else
+	return __builtin_ctz(value);
+#endif
+}
+
+// Add delta to value in a single step other threads can't split, returns the new value
+static INLINE long atomicAdd(volatile long *value, long delta)
+{
+#ifdef _MSC_VER
+	return _InterlockedExchangeAdd(value, delta) + delta;
+#else
+	return __sync_add_and_fetch(value, delta);
+#endif
+}
+
+// Aligned heap memory, release it with alignedFree()
+void *alignedAlloc(size_t size, size_t alignment);
+void alignedFree(void *p);
+
+// Convert 16-bits samples between the big-endian order of the files and the host order, in place
+void bigEndianSamples(unsigned short *samples, size_t count);
+
+// Switch stdin or stdout to binary mode so pixels go through pipes untouched
+void setBinaryMode(FILE *fp);
+
+// Number of processors the system can run threads on
+int hardwareThreads(void);
+
+// Bytes of the L2 cache of a processor, DEFAULT_L2_SIZE when the system doesn't tell
+#define DEFAULT_L2_SIZE (256 * 1024)
+size_t cacheSizeL2(void);
+
+// Seconds from an arbitrary start, with the best resolution of the system, for timings
+double timerSeconds(void);
+
+// Nonzero when path is a directory
+int isDirectory(const char *path);
+
+// Paths of the files of a directory ("dir/name"), not recursive. The array and each path
+// are allocated, count receives the number of paths.
+char **listDirectory(const char *dir, int *count);
+
+// Create a file that must not exist yet, for writing. Returns NULL when it exists or can't be created.
+FILE *createNewFile(const char *filename);
+
+// Reserve size bytes on disk for a new file so it is written without growing it piece by piece.
+// It is only a hint, nothing is reported when the system can't do it.
+void preallocateFile(FILE *fp, unsigned long long size);
+
+// Flush the buffers of fp down to the disk, returns 0 on success
+int syncFile(FILE *fp);
+
+// Rename source to target, replacing target in a single step. Returns 0 on success.
+int replaceFile(const char *source, const char *target);
+
+// Map a whole file in memory, read-only or copy-on-write. Returns NULL on failure.
+void *mapFile(const char *filename, int copyOnWrite, size_t *size);
+void unmapFile(void *view, size_t size);
+
+#endif
@@ -0,0 +1,183 @@
+#include "platform.h"
+#include "pointops.h"
+#include "parallel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// Structure for the rows of a chain run
+typedef struct {
+	const PointChain *chain;
+	Image *img;
+} PointTask;
+
+PointChain *createPointChain(int channels, int maxval)
+{
+	PointChain *chain;
+	int c, v;
+
+	chain = (PointChain *)malloc(sizeof(PointChain));
+	if (!chain) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+	chain->channels = channels;
+	chain->maxval = maxval;
+	chain->shared = 1;
+	chain->tables = malloc((size_t)channels * (maxval + 1) * (maxval > RGB_TOTAL_COLORS ? 2 : 1));
+	if (!chain->tables) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	// every table starts as the identity
+	for (c = 0; c < channels; c++) {
+		for (v = 0; v <= maxval; v++) {
+			if (maxval > RGB_TOTAL_COLORS)
+				((unsigned short *)chain->tables)[(size_t)(maxval + 1) * c + v] = (unsigned short)v;
+			else
+				((unsigned char *)chain->tables)[(size_t)(maxval + 1) * c + v] = (unsigned char)v;
+		}
+	}
+	return chain;
+}
+
+void freePointChain(PointChain *chain)
+{
+	if (!chain)
+		return;
+
+	free(chain->tables);
+	free(chain);
+}
+
+// Result of an operation on a sample, rounded and clamped to the samples
+static int pointValue(PointOperation operation, int sample, int maxval, double a, double b)
+{
+	double x = (double)sample / maxval, result;
+
+	switch (operation) {
+	case POINT_INVERT:
+		return maxval - sample;
+	case POINT_BRIGHTNESS:
+		result = x + a;
+		break;
+	case POINT_CONTRAST:
+		result = (x - 0.5) * a + 0.5;
+		break;
+	case POINT_GAMMA:
+		result = a > 0 ? pow(x, 1 / a) : x;
+		break;
+	case POINT_LEVELS:
+		result = b > a ? (x - a) / (b - a) : x >= a;
+		break;
+	case POINT_THRESHOLD:
+		return x >= a ? maxval : 0;
+	default:
+		return sample;
+	}
+
+	result = floor(result * maxval + 0.5);
+	return result < 0 ? 0 : result > maxval ? maxval : (int)result;
+}
+
+void addPointOperation(PointChain *chain, PointOperation operation, int channel, double a, double b)
+{
+	size_t size = (size_t)chain->maxval + 1;
+	int c, v, first, last, *results;
+
+	first = channel == POINT_ALL_CHANNELS ? 0 : channel;
+	last = channel == POINT_ALL_CHANNELS ? chain->channels - 1 : channel;
+	if (first < 0 || last >= chain->channels)
+		return;
+	if (first == last && chain->channels > 1)
+		chain->shared = 0;
+
+	// the operation only depends on the sample, so it is computed once per value
+	results = (int *)malloc(size * sizeof(int));
+	if (!results) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+	for (v = 0; v <= chain->maxval; v++)
+		results[v] = pointValue(operation, v, chain->maxval, a, b);
+
+	// the chain so far then the operation, for every table it applies to
+	for (c = first; c <= last; c++) {
+		if (chain->maxval > RGB_TOTAL_COLORS) {
+			unsigned short *table = (unsigned short *)chain->tables + size * c;
+			for (v = 0; v <= chain->maxval; v++)
+				table[v] = (unsigned short)results[table[v]];
+		}
+		else {
+			unsigned char *table = (unsigned char *)chain->tables + size * c;
+			for (v = 0; v <= chain->maxval; v++)
+				table[v] = (unsigned char)results[table[v]];
+		}
+	}
+
+	free(results);
+}
+
+// Lookups of a row, along the whole row when the channels share a table. The loop is unrolled so
+// the loads of several samples are in flight at once, table lookups don't map onto vector
+// instructions without gathers, which are no faster.
+#define DEFINE_POINT_ROW(name, Sample) \
+static void name(const PointChain *chain, Sample *row, int x) \
+{ \
+	const Sample *tables = (const Sample *)chain->tables; \
+	size_t size = (size_t)chain->maxval + 1, k, samples = (size_t)x * chain->channels; \
+ \
+	if (chain->shared) { \
+		for (k = 0; k + 4 <= samples; k += 4) { \
+			row[k] = tables[row[k]]; \
+			row[k + 1] = tables[row[k + 1]]; \
+			row[k + 2] = tables[row[k + 2]]; \
+			row[k + 3] = tables[row[k + 3]]; \
+		} \
+		for (; k < samples; k++) \
+			row[k] = tables[row[k]]; \
+		return; \
+	} \
+ \
+	/* a single channel always shares its table, so this is an RGB row */ \
+	for (k = 0; k + 3 <= samples; k += 3) { \
+		row[k] = tables[row[k]]; \
+		row[k + 1] = tables[size + row[k + 1]]; \
+		row[k + 2] = tables[2 * size + row[k + 2]]; \
+	} \
+}
+
+DEFINE_POINT_ROW(pointRow, unsigned char)
+DEFINE_POINT_ROW(pointRow16, unsigned short)
+
+static void rangePointChain(void *arg, int start, int end, int worker)
+{
+	PointTask *task = (PointTask *)arg;
+	int j;
+
+	(void)worker;
+	for (j = start; j < end; j++) {
+		if (task->img->depth == 1)
+			pointRow(task->chain, imageSamples(task->img, j), task->img->x);
+		else
+			pointRow16(task->chain, imageSamples16(task->img, j), task->img->x);
+	}
+}
+
+void applyPointChain(const PointChain *chain, Image *img)
+{
+	PointTask task;
+
+	if (!img || !chain)
+		return;
+	if (img->channels != chain->channels || img->maxval != chain->maxval) {
+		fprintf(stderr, "Point operations built for another image format\n");
+		exit(1);
+	}
+
+	task.chain = chain;
+	task.img = img;
+	parallelFor(0, img->y, 0, rangePointChain, &task);
+}
@@ -0,0 +1,40 @@
+#ifndef POINTOPS_H
+#define POINTOPS_H
+
+#include "image.h"
+
+#define POINT_ALL_CHANNELS -1 // Channel of the operations applied to every channel
+
+// Operations changing each sample on its own. Their parameters are fractions of maxval, so a
+// chain gives the same result on 8-bits and 16-bits images.
+typedef enum {
+	POINT_INVERT, // maxval - sample
+	POINT_BRIGHTNESS, // Adds a, from -1 to 1
+	POINT_CONTRAST, // Scales the distance to the middle gray by a
+	POINT_GAMMA, // Raises to the power 1 / a, above 1 it brightens the midtones
+	POINT_LEVELS, // Stretches a to b over the whole range, the samples outside are clamped
+	POINT_THRESHOLD // maxval from a up, 0 below
+} PointOperation;
+
+// Chain of point operations, composed as they are added into one lookup table per channel, so
+// the whole chain costs a single pass over the image. Each operation rounds its results to
+// samples, so the chain gives exactly what running the operations one after the other would.
+typedef struct {
+	int channels, maxval;
+	int shared; // Nonzero while every channel has the same table
+	void *tables; // A table of maxval + 1 samples per channel, unsigned char or unsigned short
+} PointChain;
+
+// Empty chain, for images of the given channels and maxval
+PointChain *createPointChain(int channels, int maxval);
+void freePointChain(PointChain *chain);
+
+// Add an operation at the end of the chain, for one channel (0 to channels - 1) or POINT_ALL_CHANNELS.
+// a and b are the parameters of the operation, the ones it doesn't use are ignored.
+void addPointOperation(PointChain *chain, PointOperation operation, int channel, double a, double b);
+
+// Run the chain on img, which must have its channels and maxval. The rows are split between
+// parallelThreads() threads.
+void applyPointChain(const PointChain *chain, Image *img);
+
+#endif
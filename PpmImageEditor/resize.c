@@ -0,0 +1,341 @@
+#include "platform.h"
+#include "resize.h"
+#include "parallel.h"
+#include "simd.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define RESIZE_PI 3.14159265358979323846
+
+// Weights of the new pixels along one side
+typedef struct {
+	int taps; // Source pixels each new pixel reads
+	int stride; // Weights per new pixel, taps rounded up to an even count as the resampling kernels take them
+	int *starts; // First source pixel of each new pixel, its window always fits the source
+	short *weights; // stride weights per new pixel, of RESAMPLE_BITS fraction bits, the ones past taps are 0
+} ResizeWeights;
+
+// Structure for the rows of a resize
+typedef struct {
+	const Image *src;
+	Image *dst;
+	ResizeWeights columns, rows;
+	unsigned char *lines; // A source row wide line per worker, the rows once resampled
+	void *pointers; // rows.stride row pointers per worker
+} ResizeTask;
+
+// Structure for the rows of a decimation
+typedef struct {
+	const Image *src;
+	Image *dst;
+	int factor;
+	unsigned int *totals; // src->x * channels totals per worker
+} DecimateTask;
+
+static double filterSupport(ResizeFilter filter)
+{
+	switch (filter) {
+	case RESIZE_AREA:
+		return 0.5;
+	case RESIZE_BILINEAR:
+		return 1;
+	default:
+		return LANCZOS_LOBES;
+	}
+}
+
+// Weight of the source pixel x for the new pixel centered on center, the filter being stretched by stretch
+static double pixelWeight(ResizeFilter filter, int x, double center, double stretch)
+{
+	double low, high, d;
+
+	switch (filter) {
+	case RESIZE_AREA:
+		// the part of the pixel inside the new pixel
+		low = x > center - stretch / 2 ? x : center - stretch / 2;
+		high = x + 1 < center + stretch / 2 ? x + 1 : center + stretch / 2;
+		return high > low ? high - low : 0;
+	case RESIZE_BILINEAR:
+		d = fabs(x + 0.5 - center) / stretch;
+		return d < 1 ? 1 - d : 0;
+	default:
+		d = fabs(x + 0.5 - center) / stretch;
+		if (d >= LANCZOS_LOBES)
+			return 0;
+		if (d < 1e-9)
+			return 1;
+		return sin(RESIZE_PI * d) / (RESIZE_PI * d) * sin(RESIZE_PI * d / LANCZOS_LOBES) / (RESIZE_PI * d / LANCZOS_LOBES);
+	}
+}
+
+// Weights of the out new pixels of a side of in source pixels. The new pixel i is centered on
+// (i + 0.5) * in / out in the source, and the filter is stretched by the same factor when shrinking.
+static void computeWeights(ResizeWeights *w, int in, int out, ResizeFilter filter)
+{
+	double scale = (double)in / out, stretch = scale > 1 ? scale : 1, support = filterSupport(filter) * stretch;
+	double center, sum, *values;
+	int i, t, x, first, last, largest, total;
+	short *weight;
+
+	w->taps = 2 * (int)ceil(support) + 1;
+	if (w->taps > in)
+		w->taps = in;
+	w->stride = (w->taps + 1) & ~1;
+	w->starts = (int *)malloc(out * sizeof(int));
+	w->weights = (short *)calloc((size_t)out * w->stride, sizeof(short));
+	values = (double *)malloc(w->taps * sizeof(double));
+	if (!w->starts || !w->weights || !values) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	for (i = 0; i < out; i++) {
+		center = (i + 0.5) * scale;
+		first = (int)floor(center - support);
+		last = (int)ceil(center + support);
+		if (first < 0)
+			first = 0;
+		if (last > in)
+			last = in;
+
+		// the window moves back when it would go past the end, the pixels outside [first, last) get 0
+		w->starts[i] = first + w->taps <= in ? first : in - w->taps;
+		sum = 0;
+		for (t = 0; t < w->taps; t++) {
+			x = w->starts[i] + t;
+			values[t] = x >= first && x < last ? pixelWeight(filter, x, center, stretch) : 0;
+			sum += values[t];
+		}
+		if (sum == 0) {
+			// a window too narrow to meet the filter takes the nearest pixel
+			t = (int)center - w->starts[i];
+			t = t < 0 ? 0 : t < w->taps ? t : w->taps - 1;
+			values[t] = sum = 1;
+		}
+
+		// the rounded weights must add up to 1 exactly, the largest one takes the difference
+		weight = w->weights + (size_t)w->stride * i;
+		total = 0;
+		largest = 0;
+		for (t = 0; t < w->taps; t++) {
+			weight[t] = (short)floor(values[t] / sum * (1 << RESAMPLE_BITS) + 0.5);
+			total += weight[t];
+			if (weight[t] > weight[largest])
+				largest = t;
+		}
+		weight[largest] = (short)(weight[largest] + (1 << RESAMPLE_BITS) - total);
+	}
+	free(values);
+}
+
+static void freeWeights(ResizeWeights *w)
+{
+	free(w->starts);
+	free(w->weights);
+}
+
+// Resample a row along its length, for one component type and number of channels
+#define DEFINE_RESIZE_ROW(name, Sample, CHANNELS) \
+static void name(const Sample *src, Sample *dst, const ResizeWeights *w, int x, int maxval) \
+{ \
+	const short *weight; \
+	const Sample *pixel; \
+	int i, t, c, sum[CHANNELS]; \
+ \
+	for (i = 0; i < x; i++) { \
+		weight = w->weights + (size_t)w->stride * i; \
+		pixel = src + (size_t)w->starts[i] * CHANNELS; \
+		for (c = 0; c < CHANNELS; c++) \
+			sum[c] = 1 << (RESAMPLE_BITS - 1); \
+		for (t = 0; t < w->taps; t++) \
+			for (c = 0; c < CHANNELS; c++) \
+				sum[c] += weight[t] * pixel[CHANNELS * t + c]; \
+		for (c = 0; c < CHANNELS; c++) { \
+			sum[c] = sum[c] < 0 ? 0 : sum[c] >> RESAMPLE_BITS; \
+			dst[CHANNELS * i + c] = (Sample)(sum[c] < maxval ? sum[c] : maxval); \
+		} \
+	} \
+}
+
+DEFINE_RESIZE_ROW(resizeRowGray, unsigned char, 1)
+DEFINE_RESIZE_ROW(resizeRowRgb, unsigned char, 3)
+DEFINE_RESIZE_ROW(resizeRowGray16, unsigned short, 1)
+DEFINE_RESIZE_ROW(resizeRowRgb16, unsigned short, 3)
+
+static void rangeResize(void *arg, int start, int end, int worker)
+{
+	ResizeTask *task = (ResizeTask *)arg;
+	const Image *src = task->src;
+	Image *dst = task->dst;
+	const SimdKernels *kernels = simdKernels();
+	const ResizeWeights *rows = &task->rows;
+	unsigned char *line, *out;
+	void *pointers = (void **)task->pointers + (size_t)rows->stride * worker;
+	int j, t, r;
+
+	for (j = start; j < end; j++) {
+		out = imageSamples(dst, j);
+
+		// the rows first, when the height changes, written straight to the new image when the width doesn't
+		if (src->y == dst->y) {
+			line = imageSamples(src, j);
+		}
+		else {
+			line = src->x == dst->x ? out : task->lines + imageRowSize(src) * worker;
+			for (t = 0; t < rows->stride; t++) {
+				r = rows->starts[j] + t < src->y ? rows->starts[j] + t : src->y - 1;
+				if (src->depth == 1)
+					((const unsigned char **)pointers)[t] = imageSamples(src, r);
+				else
+					((const unsigned short **)pointers)[t] = imageSamples16(src, r);
+			}
+			if (src->depth == 1)
+				kernels->resample(line, (const unsigned char *const *)pointers, rows->weights + (size_t)rows->stride * j,
+					rows->stride, imageRowSamples(src), src->maxval);
+			else
+				kernels->resample16((unsigned short *)line, (const unsigned short *const *)pointers,
+					rows->weights + (size_t)rows->stride * j, rows->stride, imageRowSamples(src), src->maxval);
+		}
+
+		// then the pixels along the row
+		if (src->x == dst->x) {
+			if (line != out)
+				memcpy(out, line, imageRowSize(dst));
+		}
+		else if (src->depth == 1) {
+			if (src->channels == 3)
+				resizeRowRgb(line, out, &task->columns, dst->x, src->maxval);
+			else
+				resizeRowGray(line, out, &task->columns, dst->x, src->maxval);
+		}
+		else {
+			if (src->channels == 3)
+				resizeRowRgb16((const unsigned short *)line, (unsigned short *)out, &task->columns, dst->x, src->maxval);
+			else
+				resizeRowGray16((const unsigned short *)line, (unsigned short *)out, &task->columns, dst->x, src->maxval);
+		}
+	}
+}
+
+Image *resizeImage(const Image *img, int x, int y, ResizeFilter filter)
+{
+	ResizeTask task;
+	Image *dst;
+	int workers = parallelThreads();
+
+	if (!img || x < 1 || y < 1)
+		return NULL;
+
+	// whole blocks are averaged without weights
+	if (filter == RESIZE_AREA && img->x % x == 0 && img->y % y == 0 && img->x / x == img->y / y)
+		return decimateImage(img, img->x / x);
+
+	dst = createImage(x, y, img->channels, img->maxval, 0);
+	if (!dst) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+	dst->format = img->format;
+
+	task.src = img;
+	task.dst = dst;
+	computeWeights(&task.columns, img->x, x, filter);
+	computeWeights(&task.rows, img->y, y, filter);
+	task.lines = (unsigned char *)malloc(imageRowSize(img) * workers);
+	task.pointers = malloc((size_t)task.rows.stride * workers * sizeof(void *));
+	if (!task.lines || !task.pointers) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	parallelFor(0, y, 0, rangeResize, &task);
+
+	free(task.pointers);
+	free(task.lines);
+	freeWeights(&task.rows);
+	freeWeights(&task.columns);
+	return dst;
+}
+
+void decimateRows(const unsigned char *rows, size_t rowSize, int count, int x, int channels, int depth,
+	int factor, unsigned int *totals, unsigned char *out)
+{
+	const SimdKernels *kernels = simdKernels();
+	size_t samples = (size_t)x * channels;
+	unsigned long long sum, area;
+	int i, k, c, r, x0, width;
+
+	// the columns of the block of rows first, then the blocks along them
+	memset(totals, 0, samples * sizeof(unsigned int));
+	for (r = 0; r < count; r++) {
+		if (depth == 1)
+			kernels->accumulate8(totals, rows + rowSize * r, samples, 1);
+		else
+			kernels->accumulate(totals, (const unsigned short *)(rows + rowSize * r), samples, 1);
+	}
+
+	for (i = 0, x0 = 0; x0 < x; i++, x0 += factor) {
+		width = x - x0 < factor ? x - x0 : factor;
+		area = (unsigned long long)width * count;
+		for (c = 0; c < channels; c++) {
+			sum = 0;
+			for (k = 0; k < width; k++)
+				sum += totals[(size_t)(x0 + k) * channels + c];
+			if (depth == 1)
+				out[(size_t)i * channels + c] = (unsigned char)((sum + area / 2) / area);
+			else
+				((unsigned short *)out)[(size_t)i * channels + c] = (unsigned short)((sum + area / 2) / area);
+		}
+	}
+}
+
+static void rangeDecimate(void *arg, int start, int end, int worker)
+{
+	DecimateTask *task = (DecimateTask *)arg;
+	const Image *src = task->src;
+	int j, count;
+
+	for (j = start; j < end; j++) {
+		count = src->y - j * task->factor < task->factor ? src->y - j * task->factor : task->factor;
+		decimateRows(imageSamples(src, j * task->factor), src->stride, count, src->x, src->channels, src->depth,
+			task->factor, task->totals + imageRowSamples(src) * worker, imageSamples(task->dst, j));
+	}
+}
+
+Image *decimateImage(const Image *img, int factor)
+{
+	DecimateTask task;
+	Image *dst;
+
+	if (!img || factor < 1)
+		return NULL;
+
+	dst = createImage((img->x + factor - 1) / factor, (img->y + factor - 1) / factor, img->channels, img->maxval, 0);
+	task.totals = (unsigned int *)malloc(imageRowSamples(img) * parallelThreads() * sizeof(unsigned int));
+	if (!dst || !task.totals) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	dst->format = img->format;
+	task.src = img;
+	task.dst = dst;
+	task.factor = factor;
+	parallelFor(0, dst->y, 0, rangeDecimate, &task);
+
+	free(task.totals);
+	return dst;
+}
+
+int findResizeFilter(const char *name)
+{
+	if (strcmp(name, "area") == 0)
+		return RESIZE_AREA;
+	if (strcmp(name, "bilinear") == 0)
+		return RESIZE_BILINEAR;
+	if (strcmp(name, "lanczos") == 0)
+		return RESIZE_LANCZOS;
+	return -1;
+}
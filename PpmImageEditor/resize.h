@@ -0,0 +1,33 @@
+#ifndef RESIZE_H
+#define RESIZE_H
+
+#include "image.h"
+
+#define LANCZOS_LOBES 3 // Lobes of the Lanczos window, each new pixel reads 3 pixels on each side
+
+typedef enum {
+	RESIZE_AREA, // Average of the pixels each new pixel covers, weighted by the part of them it covers
+	RESIZE_BILINEAR, // Linear interpolation between the 2 nearest pixels
+	RESIZE_LANCZOS // Windowed sinc, the sharpest
+} ResizeFilter;
+
+// Resize img to x by y pixels in a new image, NULL when the size is invalid. Every new row is a
+// weighted sum of source rows, then every new pixel a weighted sum of the pixels of that row, with
+// fixed-point weights computed once per row and column. When shrinking, the filters stretch over all
+// the pixels a new pixel covers, so nothing is skipped. The rows are split between parallelThreads() threads.
+Image *resizeImage(const Image *img, int x, int y, ResizeFilter filter);
+
+// Shrink img by factor, each new pixel being the rounded average of a factor x factor block,
+// cut at the right and bottom borders. Area resizes by the same integer factor on both sides use it.
+Image *decimateImage(const Image *img, int factor);
+
+// New row of decimateImage() from count rows (factor, or fewer at the bottom) of x pixels, starting
+// rowSize bytes apart. out gets (x + factor - 1) / factor pixels, totals holds x * channels values.
+// It lets images be shrunk while they are read, see readImageDecimated().
+void decimateRows(const unsigned char *rows, size_t rowSize, int count, int x, int channels, int depth,
+	int factor, unsigned int *totals, unsigned char *out);
+
+// Filter of the given name ("area", "bilinear" or "lanczos"), -1 when there is none
+int findResizeFilter(const char *name);
+
+#endif
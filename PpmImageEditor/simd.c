@@ -0,0 +1,957 @@
+#include "platform.h"
+#include "simd.h"
+#include <pthread.h>
+#include <string.h>
+#ifdef HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+// x86 processors get the wider kernels when CPUID reports them. gcc and clang compile them with
+// a target attribute, MSVC takes the intrinsics anywhere (AVX-512 from Visual Studio 2017).
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#if defined(__GNUC__) || defined(_MSC_VER)
+#define HAVE_AVX2 1
+#endif
+#if defined(__GNUC__) || (defined(_MSC_VER) && _MSC_VER >= 1911)
+#define HAVE_AVX512 1
+#endif
+#endif
+
+#if defined(HAVE_AVX2) || defined(HAVE_AVX512)
+#include <immintrin.h>
+#ifndef _MSC_VER
+#include <cpuid.h>
+#endif
+#endif
+
+#ifdef __GNUC__
+#define TARGET(isa) __attribute__((target(isa)))
+#else
+#define TARGET(isa)
+#endif
+
+static void invertScalar(unsigned char *samples, size_t count, unsigned int maxval)
+{
+	size_t k;
+
+	for (k = 0; k < count; k++)
+		samples[k] = (unsigned char)(maxval - samples[k]);
+}
+
+static void invert16Scalar(unsigned short *samples, size_t count, unsigned int maxval)
+{
+	size_t k;
+
+	for (k = 0; k < count; k++)
+		samples[k] = (unsigned short)(maxval - samples[k]);
+}
+
+static void accumulate8Scalar(unsigned int *total, const unsigned char *src, size_t count, unsigned int weight)
+{
+	size_t k;
+
+	for (k = 0; k < count; k++)
+		total[k] += weight * src[k];
+}
+
+static void accumulateScalar(unsigned int *total, const unsigned short *src, size_t count, unsigned int weight)
+{
+	size_t k;
+
+	for (k = 0; k < count; k++)
+		total[k] += weight * src[k];
+}
+
+static void slideScalar(unsigned int *total, const unsigned short *in, const unsigned short *out, size_t count)
+{
+	size_t k;
+
+	for (k = 0; k < count; k++)
+		total[k] += in[k] - out[k];
+}
+
+static void narrowScalar(unsigned char *dst, const unsigned int *total, size_t count, int shift)
+{
+	size_t k;
+
+	for (k = 0; k < count; k++)
+		dst[k] = (unsigned char)((total[k] + (1u << (shift - 1))) >> shift);
+}
+
+static void narrow16Scalar(unsigned short *dst, const unsigned int *total, size_t count, int shift)
+{
+	size_t k;
+
+	for (k = 0; k < count; k++)
+		dst[k] = (unsigned short)((total[k] + (1u << (shift - 1))) >> shift);
+}
+
+static void minMaxScalar(unsigned char *low, unsigned char *high, size_t count)
+{
+	unsigned char a, b;
+	size_t k;
+
+	for (k = 0; k < count; k++) {
+		a = low[k];
+		b = high[k];
+		low[k] = a < b ? a : b;
+		high[k] = a < b ? b : a;
+	}
+}
+
+static void minMax16Scalar(unsigned short *low, unsigned short *high, size_t count)
+{
+	unsigned short a, b;
+	size_t k;
+
+	for (k = 0; k < count; k++) {
+		a = low[k];
+		b = high[k];
+		low[k] = a < b ? a : b;
+		high[k] = a < b ? b : a;
+	}
+}
+
+// Samples start to count - 1 of the resampling kernels, the vector kernels end with it
+static void resampleFrom(unsigned char *dst, const unsigned char *const *rows, const short *weights, int taps,
+	size_t start, size_t count, unsigned int maxval)
+{
+	size_t k;
+	int t, sum;
+
+	for (k = start; k < count; k++) {
+		sum = 1 << (RESAMPLE_BITS - 1);
+		for (t = 0; t < taps; t++)
+			sum += weights[t] * rows[t][k];
+		sum = sum < 0 ? 0 : sum >> RESAMPLE_BITS;
+		dst[k] = (unsigned char)(sum < (int)maxval ? sum : (int)maxval);
+	}
+}
+
+static void resample16From(unsigned short *dst, const unsigned short *const *rows, const short *weights, int taps,
+	size_t start, size_t count, unsigned int maxval)
+{
+	size_t k;
+	int t, sum;
+
+	for (k = start; k < count; k++) {
+		sum = 1 << (RESAMPLE_BITS - 1);
+		for (t = 0; t < taps; t++)
+			sum += weights[t] * rows[t][k];
+		sum = sum < 0 ? 0 : sum >> RESAMPLE_BITS;
+		dst[k] = (unsigned short)(sum < (int)maxval ? sum : (int)maxval);
+	}
+}
+
+static void resampleScalar(unsigned char *dst, const unsigned char *const *rows, const short *weights, int taps,
+	size_t count, unsigned int maxval)
+{
+	resampleFrom(dst, rows, weights, taps, 0, count, maxval);
+}
+
+static void resample16Scalar(unsigned short *dst, const unsigned short *const *rows, const short *weights, int taps,
+	size_t count, unsigned int maxval)
+{
+	resample16From(dst, rows, weights, taps, 0, count, maxval);
+}
+
+// Weights t and t + 1 in the two halves of 32 bits, as the multiply-adds of the vector kernels take them
+#define weightPair(weights, t) \
+	((int)((unsigned int)(unsigned short)(weights)[t] | (unsigned int)(unsigned short)(weights)[(t) + 1] << 16))
+
+// Pixels of the transpose kernels, the fixed sizes let the copies compile to single moves
+#define TRANSPOSE_PIXELS(dst, dstStride, src, srcStride, SIZE) \
+	for (r = 0; r < 8; r++) \
+		for (c = 0; c < 8; c++) \
+			memcpy(dst + r * dstStride + c * SIZE, src + c * srcStride + r * SIZE, SIZE)
+
+static void transposeScalar(unsigned char *dst, ptrdiff_t dstStride, const unsigned char *src, ptrdiff_t srcStride, int pixelSize)
+{
+	int r, c;
+
+	switch (pixelSize) {
+	case 1:
+		TRANSPOSE_PIXELS(dst, dstStride, src, srcStride, 1);
+		break;
+	case 2:
+		TRANSPOSE_PIXELS(dst, dstStride, src, srcStride, 2);
+		break;
+	case 3:
+		TRANSPOSE_PIXELS(dst, dstStride, src, srcStride, 3);
+		break;
+	default:
+		TRANSPOSE_PIXELS(dst, dstStride, src, srcStride, 6);
+		break;
+	}
+}
+
+static const SimdKernels scalarKernels = {
+	SIMD_SCALAR, invertScalar, invert16Scalar, accumulate8Scalar, accumulateScalar, slideScalar,
+	narrowScalar, narrow16Scalar, minMaxScalar, minMax16Scalar, resampleScalar, resample16Scalar, transposeScalar
+};
+
+// Every vector kernel runs whole vectors then hands the tail to the scalar kernel
+
+#ifdef HAVE_SSE2
+static void invertSse2(unsigned char *samples, size_t count, unsigned int maxval)
+{
+	__m128i max = _mm_set1_epi8((char)maxval);
+	size_t k;
+
+	// the samples are at most maxval, so the differences never wrap
+	for (k = 0; k + 16 <= count; k += 16)
+		_mm_storeu_si128((__m128i *)(samples + k), _mm_sub_epi8(max, _mm_loadu_si128((const __m128i *)(samples + k))));
+	invertScalar(samples + k, count - k, maxval);
+}
+
+static void invert16Sse2(unsigned short *samples, size_t count, unsigned int maxval)
+{
+	__m128i max = _mm_set1_epi16((short)maxval);
+	size_t k;
+
+	for (k = 0; k + 8 <= count; k += 8)
+		_mm_storeu_si128((__m128i *)(samples + k), _mm_sub_epi16(max, _mm_loadu_si128((const __m128i *)(samples + k))));
+	invert16Scalar(samples + k, count - k, maxval);
+}
+
+static void accumulate8Sse2(unsigned int *total, const unsigned char *src, size_t count, unsigned int weight)
+{
+	__m128i w = _mm_set1_epi16((short)weight), zero = _mm_setzero_si128(), bytes, v, low, high;
+	size_t k;
+	int n;
+
+	// the bytes are widened to 16 bits and go through the same products as accumulateSse2()
+	for (k = 0; k + 16 <= count; k += 16) {
+		bytes = _mm_loadu_si128((const __m128i *)(src + k));
+		for (n = 0; n < 2; n++) {
+			v = n ? _mm_unpackhi_epi8(bytes, zero) : _mm_unpacklo_epi8(bytes, zero);
+			if (weight < 65536) {
+				low = _mm_mullo_epi16(v, w);
+				high = _mm_mulhi_epu16(v, w);
+			}
+			else {
+				low = zero;
+				high = v;
+			}
+			_mm_storeu_si128((__m128i *)(total + k + 8 * n),
+				_mm_add_epi32(_mm_loadu_si128((const __m128i *)(total + k + 8 * n)), _mm_unpacklo_epi16(low, high)));
+			_mm_storeu_si128((__m128i *)(total + k + 8 * n + 4),
+				_mm_add_epi32(_mm_loadu_si128((const __m128i *)(total + k + 8 * n + 4)), _mm_unpackhi_epi16(low, high)));
+		}
+	}
+	accumulate8Scalar(total + k, src + k, count - k, weight);
+}
+
+static void accumulateSse2(unsigned int *total, const unsigned short *src, size_t count, unsigned int weight)
+{
+	__m128i w = _mm_set1_epi16((short)weight), zero = _mm_setzero_si128(), v, low, high;
+	size_t k;
+
+	// SSE2 has no 32 bits multiply, the low and high halves of the 16 x 16 bits products are
+	// interleaved instead. A weight of 65536 doesn't fit 16 bits, it is a shift.
+	for (k = 0; k + 8 <= count; k += 8) {
+		v = _mm_loadu_si128((const __m128i *)(src + k));
+		if (weight < 65536) {
+			low = _mm_mullo_epi16(v, w);
+			high = _mm_mulhi_epu16(v, w);
+		}
+		else {
+			low = zero;
+			high = v;
+		}
+		_mm_storeu_si128((__m128i *)(total + k),
+			_mm_add_epi32(_mm_loadu_si128((const __m128i *)(total + k)), _mm_unpacklo_epi16(low, high)));
+		_mm_storeu_si128((__m128i *)(total + k + 4),
+			_mm_add_epi32(_mm_loadu_si128((const __m128i *)(total + k + 4)), _mm_unpackhi_epi16(low, high)));
+	}
+	accumulateScalar(total + k, src + k, count - k, weight);
+}
+
+static void slideSse2(unsigned int *total, const unsigned short *in, const unsigned short *out, size_t count)
+{
+	__m128i zero = _mm_setzero_si128(), a, b, t;
+	size_t k;
+
+	for (k = 0; k + 8 <= count; k += 8) {
+		a = _mm_loadu_si128((const __m128i *)(in + k));
+		b = _mm_loadu_si128((const __m128i *)(out + k));
+		t = _mm_loadu_si128((const __m128i *)(total + k));
+		t = _mm_sub_epi32(_mm_add_epi32(t, _mm_unpacklo_epi16(a, zero)), _mm_unpacklo_epi16(b, zero));
+		_mm_storeu_si128((__m128i *)(total + k), t);
+		t = _mm_loadu_si128((const __m128i *)(total + k + 4));
+		t = _mm_sub_epi32(_mm_add_epi32(t, _mm_unpackhi_epi16(a, zero)), _mm_unpackhi_epi16(b, zero));
+		_mm_storeu_si128((__m128i *)(total + k + 4), t);
+	}
+	slideScalar(total + k, in + k, out + k, count - k);
+}
+
+static void narrowSse2(unsigned char *dst, const unsigned int *total, size_t count, int shift)
+{
+	__m128i round = _mm_set1_epi32(1 << (shift - 1)), bits = _mm_cvtsi32_si128(shift), v[4];
+	size_t k;
+	int n;
+
+	// the results fit 8 bits, so the saturating packs keep them as they are
+	for (k = 0; k + 16 <= count; k += 16) {
+		for (n = 0; n < 4; n++)
+			v[n] = _mm_srl_epi32(_mm_add_epi32(_mm_loadu_si128((const __m128i *)(total + k + 4 * n)), round), bits);
+		_mm_storeu_si128((__m128i *)(dst + k), _mm_packus_epi16(_mm_packs_epi32(v[0], v[1]), _mm_packs_epi32(v[2], v[3])));
+	}
+	narrowScalar(dst + k, total + k, count - k, shift);
+}
+
+static void narrow16Sse2(unsigned short *dst, const unsigned int *total, size_t count, int shift)
+{
+	__m128i round = _mm_set1_epi32(1 << (shift - 1)), bits = _mm_cvtsi32_si128(shift);
+	__m128i bias = _mm_set1_epi32(32768), sign = _mm_set1_epi16((short)0x8000), a, b;
+	size_t k;
+
+	// SSE2 only packs to signed 16 bits, the results are moved down by 32768 and back
+	for (k = 0; k + 8 <= count; k += 8) {
+		a = _mm_srl_epi32(_mm_add_epi32(_mm_loadu_si128((const __m128i *)(total + k)), round), bits);
+		b = _mm_srl_epi32(_mm_add_epi32(_mm_loadu_si128((const __m128i *)(total + k + 4)), round), bits);
+		a = _mm_packs_epi32(_mm_sub_epi32(a, bias), _mm_sub_epi32(b, bias));
+		_mm_storeu_si128((__m128i *)(dst + k), _mm_xor_si128(a, sign));
+	}
+	narrow16Scalar(dst + k, total + k, count - k, shift);
+}
+
+static void minMaxSse2(unsigned char *low, unsigned char *high, size_t count)
+{
+	__m128i a, b;
+	size_t k;
+
+	for (k = 0; k + 16 <= count; k += 16) {
+		a = _mm_loadu_si128((const __m128i *)(low + k));
+		b = _mm_loadu_si128((const __m128i *)(high + k));
+		_mm_storeu_si128((__m128i *)(low + k), _mm_min_epu8(a, b));
+		_mm_storeu_si128((__m128i *)(high + k), _mm_max_epu8(a, b));
+	}
+	minMaxScalar(low + k, high + k, count - k);
+}
+
+static void minMax16Sse2(unsigned short *low, unsigned short *high, size_t count)
+{
+	__m128i a, b, over;
+	size_t k;
+
+	// SSE2 has no unsigned 16-bits min and max, the saturated difference gives both
+	for (k = 0; k + 8 <= count; k += 8) {
+		a = _mm_loadu_si128((const __m128i *)(low + k));
+		b = _mm_loadu_si128((const __m128i *)(high + k));
+		over = _mm_subs_epu16(a, b);
+		_mm_storeu_si128((__m128i *)(low + k), _mm_sub_epi16(a, over));
+		_mm_storeu_si128((__m128i *)(high + k), _mm_add_epi16(b, over));
+	}
+	minMax16Scalar(low + k, high + k, count - k);
+}
+
+// The rows go by pairs with their samples interleaved, each multiply-add takes a sample of both rows.
+// The 16-bits samples are moved down by 32768 to fit the signed multiplies, as the weights add up
+// to 1 the sums are 32768 too low, which the rounding constant gives back.
+static void resampleSse2(unsigned char *dst, const unsigned char *const *rows, const short *weights, int taps,
+	size_t count, unsigned int maxval)
+{
+	__m128i zero = _mm_setzero_si128(), round = _mm_set1_epi32(1 << (RESAMPLE_BITS - 1)), max = _mm_set1_epi8((char)maxval);
+	__m128i a, b, w, low, high;
+	size_t k;
+	int t;
+
+	for (k = 0; k + 8 <= count; k += 8) {
+		low = high = round;
+		for (t = 0; t < taps; t += 2) {
+			a = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(rows[t] + k)), zero);
+			b = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(rows[t + 1] + k)), zero);
+			w = _mm_set1_epi32(weightPair(weights, t));
+			low = _mm_add_epi32(low, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), w));
+			high = _mm_add_epi32(high, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), w));
+		}
+		a = _mm_packs_epi32(_mm_srai_epi32(low, RESAMPLE_BITS), _mm_srai_epi32(high, RESAMPLE_BITS));
+		_mm_storel_epi64((__m128i *)(dst + k), _mm_min_epu8(_mm_packus_epi16(a, a), max));
+	}
+	resampleFrom(dst, rows, weights, taps, k, count, maxval);
+}
+
+static void resample16Sse2(unsigned short *dst, const unsigned short *const *rows, const short *weights, int taps,
+	size_t count, unsigned int maxval)
+{
+	__m128i round = _mm_set1_epi32((1 << (RESAMPLE_BITS - 1)) + (32768 << RESAMPLE_BITS)), bias = _mm_set1_epi32(32768);
+	__m128i sign = _mm_set1_epi16((short)0x8000), max = _mm_set1_epi16((short)(maxval - 32768)), a, b, w, low, high;
+	size_t k;
+	int t;
+
+	for (k = 0; k + 8 <= count; k += 8) {
+		low = high = round;
+		for (t = 0; t < taps; t += 2) {
+			a = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(rows[t] + k)), sign);
+			b = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(rows[t + 1] + k)), sign);
+			w = _mm_set1_epi32(weightPair(weights, t));
+			low = _mm_add_epi32(low, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), w));
+			high = _mm_add_epi32(high, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), w));
+		}
+		// the signed pack clamps to 0 to 65535 once moved down by 32768
+		a = _mm_packs_epi32(_mm_sub_epi32(_mm_srai_epi32(low, RESAMPLE_BITS), bias),
+			_mm_sub_epi32(_mm_srai_epi32(high, RESAMPLE_BITS), bias));
+		_mm_storeu_si128((__m128i *)(dst + k), _mm_xor_si128(_mm_min_epi16(a, max), sign));
+	}
+	resample16From(dst, rows, weights, taps, k, count, maxval);
+}
+
+// The rows are interleaved by pairs of samples, then of 2 and 4 samples, which leaves the columns
+// in the registers. 3 and 6 bytes pixels need byte shuffles, they are left to the wider levels.
+static void transposeSse2(unsigned char *dst, ptrdiff_t dstStride, const unsigned char *src, ptrdiff_t srcStride, int pixelSize)
+{
+	__m128i a[8], b[8];
+	int r;
+
+	if (pixelSize == 1) {
+		for (r = 0; r < 8; r++)
+			a[r] = _mm_loadl_epi64((const __m128i *)(src + r * srcStride));
+		for (r = 0; r < 4; r++)
+			b[r] = _mm_unpacklo_epi8(a[2 * r], a[2 * r + 1]);
+		a[0] = _mm_unpacklo_epi16(b[0], b[1]);
+		a[1] = _mm_unpackhi_epi16(b[0], b[1]);
+		a[2] = _mm_unpacklo_epi16(b[2], b[3]);
+		a[3] = _mm_unpackhi_epi16(b[2], b[3]);
+		b[0] = _mm_unpacklo_epi32(a[0], a[2]);
+		b[1] = _mm_unpackhi_epi32(a[0], a[2]);
+		b[2] = _mm_unpacklo_epi32(a[1], a[3]);
+		b[3] = _mm_unpackhi_epi32(a[1], a[3]);
+		for (r = 0; r < 4; r++) {
+			_mm_storel_epi64((__m128i *)(dst + 2 * r * dstStride), b[r]);
+			_mm_storel_epi64((__m128i *)(dst + (2 * r + 1) * dstStride), _mm_srli_si128(b[r], 8));
+		}
+	}
+	else if (pixelSize == 2) {
+		for (r = 0; r < 8; r++)
+			a[r] = _mm_loadu_si128((const __m128i *)(src + r * srcStride));
+		for (r = 0; r < 4; r++) {
+			b[2 * r] = _mm_unpacklo_epi16(a[2 * r], a[2 * r + 1]);
+			b[2 * r + 1] = _mm_unpackhi_epi16(a[2 * r], a[2 * r + 1]);
+		}
+		for (r = 0; r < 2; r++) {
+			a[4 * r] = _mm_unpacklo_epi32(b[4 * r], b[4 * r + 2]);
+			a[4 * r + 1] = _mm_unpackhi_epi32(b[4 * r], b[4 * r + 2]);
+			a[4 * r + 2] = _mm_unpacklo_epi32(b[4 * r + 1], b[4 * r + 3]);
+			a[4 * r + 3] = _mm_unpackhi_epi32(b[4 * r + 1], b[4 * r + 3]);
+		}
+		for (r = 0; r < 4; r++) {
+			_mm_storeu_si128((__m128i *)(dst + 2 * r * dstStride), _mm_unpacklo_epi64(a[r], a[r + 4]));
+			_mm_storeu_si128((__m128i *)(dst + (2 * r + 1) * dstStride), _mm_unpackhi_epi64(a[r], a[r + 4]));
+		}
+	}
+	else {
+		transposeScalar(dst, dstStride, src, srcStride, pixelSize);
+	}
+}
+
+static const SimdKernels sse2Kernels = {
+	SIMD_SSE2, invertSse2, invert16Sse2, accumulate8Sse2, accumulateSse2, slideSse2,
+	narrowSse2, narrow16Sse2, minMaxSse2, minMax16Sse2, resampleSse2, resample16Sse2, transposeSse2
+};
+#endif
+
+#ifdef HAVE_AVX2
+TARGET("avx2") static void invertAvx2(unsigned char *samples, size_t count, unsigned int maxval)
+{
+	__m256i max = _mm256_set1_epi8((char)maxval);
+	size_t k;
+
+	for (k = 0; k + 32 <= count; k += 32)
+		_mm256_storeu_si256((__m256i *)(samples + k), _mm256_sub_epi8(max, _mm256_loadu_si256((const __m256i *)(samples + k))));
+	invertScalar(samples + k, count - k, maxval);
+}
+
+TARGET("avx2") static void invert16Avx2(unsigned short *samples, size_t count, unsigned int maxval)
+{
+	__m256i max = _mm256_set1_epi16((short)maxval);
+	size_t k;
+
+	for (k = 0; k + 16 <= count; k += 16)
+		_mm256_storeu_si256((__m256i *)(samples + k), _mm256_sub_epi16(max, _mm256_loadu_si256((const __m256i *)(samples + k))));
+	invert16Scalar(samples + k, count - k, maxval);
+}
+
+TARGET("avx2") static void accumulate8Avx2(unsigned int *total, const unsigned char *src, size_t count, unsigned int weight)
+{
+	__m256i w = _mm256_set1_epi32((int)weight), a, b;
+	size_t k;
+
+	for (k = 0; k + 16 <= count; k += 16) {
+		a = _mm256_mullo_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + k))), w);
+		b = _mm256_mullo_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + k + 8))), w);
+		_mm256_storeu_si256((__m256i *)(total + k), _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(total + k)), a));
+		_mm256_storeu_si256((__m256i *)(total + k + 8), _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(total + k + 8)), b));
+	}
+	accumulate8Scalar(total + k, src + k, count - k, weight);
+}
+
+TARGET("avx2") static void accumulateAvx2(unsigned int *total, const unsigned short *src, size_t count, unsigned int weight)
+{
+	__m256i w = _mm256_set1_epi32((int)weight), a, b;
+	size_t k;
+
+	for (k = 0; k + 16 <= count; k += 16) {
+		a = _mm256_mullo_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(src + k))), w);
+		b = _mm256_mullo_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(src + k + 8))), w);
+		_mm256_storeu_si256((__m256i *)(total + k), _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(total + k)), a));
+		_mm256_storeu_si256((__m256i *)(total + k + 8), _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(total + k + 8)), b));
+	}
+	accumulateScalar(total + k, src + k, count - k, weight);
+}
+
+TARGET("avx2") static void slideAvx2(unsigned int *total, const unsigned short *in, const unsigned short *out, size_t count)
+{
+	__m256i t;
+	size_t k;
+
+	for (k = 0; k + 8 <= count; k += 8) {
+		t = _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(total + k)),
+			_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(in + k))));
+		t = _mm256_sub_epi32(t, _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(out + k))));
+		_mm256_storeu_si256((__m256i *)(total + k), t);
+	}
+	slideScalar(total + k, in + k, out + k, count - k);
+}
+
+TARGET("avx2") static void narrowAvx2(unsigned char *dst, const unsigned int *total, size_t count, int shift)
+{
+	__m256i round = _mm256_set1_epi32(1 << (shift - 1)), order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7), v[4];
+	__m128i bits = _mm_cvtsi32_si128(shift);
+	size_t k;
+	int n;
+
+	// the packs work within each 128 bits lane, the final permute puts the 4 bytes groups back in order
+	for (k = 0; k + 32 <= count; k += 32) {
+		for (n = 0; n < 4; n++)
+			v[n] = _mm256_srl_epi32(_mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(total + k + 8 * n)), round), bits);
+		v[0] = _mm256_packus_epi16(_mm256_packs_epi32(v[0], v[1]), _mm256_packs_epi32(v[2], v[3]));
+		_mm256_storeu_si256((__m256i *)(dst + k), _mm256_permutevar8x32_epi32(v[0], order));
+	}
+	narrowScalar(dst + k, total + k, count - k, shift);
+}
+
+TARGET("avx2") static void narrow16Avx2(unsigned short *dst, const unsigned int *total, size_t count, int shift)
+{
+	__m256i round = _mm256_set1_epi32(1 << (shift - 1)), a, b;
+	__m128i bits = _mm_cvtsi32_si128(shift);
+	size_t k;
+
+	for (k = 0; k + 16 <= count; k += 16) {
+		a = _mm256_srl_epi32(_mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(total + k)), round), bits);
+		b = _mm256_srl_epi32(_mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(total + k + 8)), round), bits);
+		_mm256_storeu_si256((__m256i *)(dst + k), _mm256_permute4x64_epi64(_mm256_packus_epi32(a, b), 0xD8));
+	}
+	narrow16Scalar(dst + k, total + k, count - k, shift);
+}
+
+TARGET("avx2") static void minMaxAvx2(unsigned char *low, unsigned char *high, size_t count)
+{
+	__m256i a, b;
+	size_t k;
+
+	for (k = 0; k + 32 <= count; k += 32) {
+		a = _mm256_loadu_si256((const __m256i *)(low + k));
+		b = _mm256_loadu_si256((const __m256i *)(high + k));
+		_mm256_storeu_si256((__m256i *)(low + k), _mm256_min_epu8(a, b));
+		_mm256_storeu_si256((__m256i *)(high + k), _mm256_max_epu8(a, b));
+	}
+	minMaxScalar(low + k, high + k, count - k);
+}
+
+TARGET("avx2") static void minMax16Avx2(unsigned short *low, unsigned short *high, size_t count)
+{
+	__m256i a, b;
+	size_t k;
+
+	for (k = 0; k + 16 <= count; k += 16) {
+		a = _mm256_loadu_si256((const __m256i *)(low + k));
+		b = _mm256_loadu_si256((const __m256i *)(high + k));
+		_mm256_storeu_si256((__m256i *)(low + k), _mm256_min_epu16(a, b));
+		_mm256_storeu_si256((__m256i *)(high + k), _mm256_max_epu16(a, b));
+	}
+	minMax16Scalar(low + k, high + k, count - k);
+}
+
+// The unpacks and packs work within each 128 bits lane, so the packs put back the order the unpacks changed
+TARGET("avx2") static void resampleAvx2(unsigned char *dst, const unsigned char *const *rows, const short *weights, int taps,
+	size_t count, unsigned int maxval)
+{
+	__m256i round = _mm256_set1_epi32(1 << (RESAMPLE_BITS - 1)), a, b, w, low, high;
+	__m128i max = _mm_set1_epi8((char)maxval);
+	size_t k;
+	int t;
+
+	for (k = 0; k + 16 <= count; k += 16) {
+		low = high = round;
+		for (t = 0; t < taps; t += 2) {
+			a = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(rows[t] + k)));
+			b = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(rows[t + 1] + k)));
+			w = _mm256_set1_epi32(weightPair(weights, t));
+			low = _mm256_add_epi32(low, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), w));
+			high = _mm256_add_epi32(high, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), w));
+		}
+		a = _mm256_packs_epi32(_mm256_srai_epi32(low, RESAMPLE_BITS), _mm256_srai_epi32(high, RESAMPLE_BITS));
+		a = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, a), 0x08);
+		_mm_storeu_si128((__m128i *)(dst + k), _mm_min_epu8(_mm256_castsi256_si128(a), max));
+	}
+	resampleFrom(dst, rows, weights, taps, k, count, maxval);
+}
+
+TARGET("avx2") static void resample16Avx2(unsigned short *dst, const unsigned short *const *rows, const short *weights, int taps,
+	size_t count, unsigned int maxval)
+{
+	__m256i round = _mm256_set1_epi32((1 << (RESAMPLE_BITS - 1)) + (32768 << RESAMPLE_BITS)), bias = _mm256_set1_epi32(32768);
+	__m256i sign = _mm256_set1_epi16((short)0x8000), max = _mm256_set1_epi16((short)(maxval - 32768)), a, b, w, low, high;
+	size_t k;
+	int t;
+
+	for (k = 0; k + 16 <= count; k += 16) {
+		low = high = round;
+		for (t = 0; t < taps; t += 2) {
+			a = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(rows[t] + k)), sign);
+			b = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(rows[t + 1] + k)), sign);
+			w = _mm256_set1_epi32(weightPair(weights, t));
+			low = _mm256_add_epi32(low, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), w));
+			high = _mm256_add_epi32(high, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), w));
+		}
+		a = _mm256_packs_epi32(_mm256_sub_epi32(_mm256_srai_epi32(low, RESAMPLE_BITS), bias),
+			_mm256_sub_epi32(_mm256_srai_epi32(high, RESAMPLE_BITS), bias));
+		_mm256_storeu_si256((__m256i *)(dst + k), _mm256_xor_si256(_mm256_min_epi16(a, max), sign));
+	}
+	resample16From(dst, rows, weights, taps, k, count, maxval);
+}
+
+// 3 bytes pixels are widened to 32 bits with byte shuffles, transposed as 8 x 8 integers and packed
+// back. Each row is read as two 16 bytes loads starting at its first and ninth byte, so nothing past
+// the 24 bytes of the row is read.
+TARGET("avx2") static void transposeAvx2(unsigned char *dst, ptrdiff_t dstStride, const unsigned char *src, ptrdiff_t srcStride, int pixelSize)
+{
+	__m128i widenLow = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+	__m128i widenHigh = _mm_setr_epi8(4, 5, 6, -1, 7, 8, 9, -1, 10, 11, 12, -1, 13, 14, 15, -1);
+	__m256i pack = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+		0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+	__m256i a[8], b[8];
+	__m128i low, high;
+	int r;
+
+	// the smaller pixels take the 128 bits kernel, or the scalar one where there is no SSE2
+	if (pixelSize != 3) {
+#ifdef HAVE_SSE2
+		transposeSse2(dst, dstStride, src, srcStride, pixelSize);
+#else
+		transposeScalar(dst, dstStride, src, srcStride, pixelSize);
+#endif
+		return;
+	}
+
+	for (r = 0; r < 8; r++) {
+		low = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + r * srcStride)), widenLow);
+		high = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + r * srcStride + 8)), widenHigh);
+		a[r] = _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1);
+	}
+
+	// within each 128 bits lane, the low lane holding the columns 0 to 3 and the high one 4 to 7
+	for (r = 0; r < 4; r++) {
+		b[2 * r] = _mm256_unpacklo_epi32(a[2 * r], a[2 * r + 1]);
+		b[2 * r + 1] = _mm256_unpackhi_epi32(a[2 * r], a[2 * r + 1]);
+	}
+	for (r = 0; r < 2; r++) {
+		a[4 * r] = _mm256_unpacklo_epi64(b[4 * r], b[4 * r + 2]);
+		a[4 * r + 1] = _mm256_unpackhi_epi64(b[4 * r], b[4 * r + 2]);
+		a[4 * r + 2] = _mm256_unpacklo_epi64(b[4 * r + 1], b[4 * r + 3]);
+		a[4 * r + 3] = _mm256_unpackhi_epi64(b[4 * r + 1], b[4 * r + 3]);
+	}
+	for (r = 0; r < 4; r++) {
+		b[r] = _mm256_permute2x128_si256(a[r], a[r + 4], 0x20);
+		b[r + 4] = _mm256_permute2x128_si256(a[r], a[r + 4], 0x31);
+	}
+
+	for (r = 0; r < 8; r++) {
+		b[r] = _mm256_shuffle_epi8(b[r], pack);
+		low = _mm256_castsi256_si128(b[r]);
+		high = _mm256_extracti128_si256(b[r], 1);
+		_mm_storeu_si128((__m128i *)(dst + r * dstStride), _mm_or_si128(low, _mm_slli_si128(high, 12)));
+		_mm_storel_epi64((__m128i *)(dst + r * dstStride + 16), _mm_srli_si128(high, 4));
+	}
+}
+
+static const SimdKernels avx2Kernels = {
+	SIMD_AVX2, invertAvx2, invert16Avx2, accumulate8Avx2, accumulateAvx2, slideAvx2,
+	narrowAvx2, narrow16Avx2, minMaxAvx2, minMax16Avx2, resampleAvx2, resample16Avx2, transposeAvx2
+};
+#endif
+
+#ifdef HAVE_AVX512
+TARGET("avx512f,avx512bw") static void invertAvx512(unsigned char *samples, size_t count, unsigned int maxval)
+{
+	__m512i max = _mm512_set1_epi8((char)maxval);
+	size_t k;
+
+	for (k = 0; k + 64 <= count; k += 64)
+		_mm512_storeu_si512(samples + k, _mm512_sub_epi8(max, _mm512_loadu_si512(samples + k)));
+	invertScalar(samples + k, count - k, maxval);
+}
+
+TARGET("avx512f,avx512bw") static void invert16Avx512(unsigned short *samples, size_t count, unsigned int maxval)
+{
+	__m512i max = _mm512_set1_epi16((short)maxval);
+	size_t k;
+
+	for (k = 0; k + 32 <= count; k += 32)
+		_mm512_storeu_si512(samples + k, _mm512_sub_epi16(max, _mm512_loadu_si512(samples + k)));
+	invert16Scalar(samples + k, count - k, maxval);
+}
+
+TARGET("avx512f,avx512bw") static void accumulate8Avx512(unsigned int *total, const unsigned char *src, size_t count, unsigned int weight)
+{
+	__m512i w = _mm512_set1_epi32((int)weight), a;
+	size_t k;
+
+	for (k = 0; k + 16 <= count; k += 16) {
+		a = _mm512_mullo_epi32(_mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *)(src + k))), w);
+		_mm512_storeu_si512(total + k, _mm512_add_epi32(_mm512_loadu_si512(total + k), a));
+	}
+	accumulate8Scalar(total + k, src + k, count - k, weight);
+}
+
+TARGET("avx512f,avx512bw") static void accumulateAvx512(unsigned int *total, const unsigned short *src, size_t count, unsigned int weight)
+{
+	__m512i w = _mm512_set1_epi32((int)weight), a;
+	size_t k;
+
+	for (k = 0; k + 16 <= count; k += 16) {
+		a = _mm512_mullo_epi32(_mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *)(src + k))), w);
+		_mm512_storeu_si512(total + k, _mm512_add_epi32(_mm512_loadu_si512(total + k), a));
+	}
+	accumulateScalar(total + k, src + k, count - k, weight);
+}
+
+TARGET("avx512f,avx512bw") static void slideAvx512(unsigned int *total, const unsigned short *in, const unsigned short *out, size_t count)
+{
+	__m512i t;
+	size_t k;
+
+	for (k = 0; k + 16 <= count; k += 16) {
+		t = _mm512_add_epi32(_mm512_loadu_si512(total + k), _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *)(in + k))));
+		t = _mm512_sub_epi32(t, _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *)(out + k))));
+		_mm512_storeu_si512(total + k, t);
+	}
+	slideScalar(total + k, in + k, out + k, count - k);
+}
+
+TARGET("avx512f,avx512bw") static void narrowAvx512(unsigned char *dst, const unsigned int *total, size_t count, int shift)
+{
+	__m512i round = _mm512_set1_epi32(1 << (shift - 1)), v;
+	__m128i bits = _mm_cvtsi32_si128(shift);
+	size_t k;
+
+	// AVX-512 narrows 32 bits values to bytes in a single instruction
+	for (k = 0; k + 16 <= count; k += 16) {
+		v = _mm512_srl_epi32(_mm512_add_epi32(_mm512_loadu_si512(total + k), round), bits);
+		_mm_storeu_si128((__m128i *)(dst + k), _mm512_cvtepi32_epi8(v));
+	}
+	narrowScalar(dst + k, total + k, count - k, shift);
+}
+
+TARGET("avx512f,avx512bw") static void narrow16Avx512(unsigned short *dst, const unsigned int *total, size_t count, int shift)
+{
+	__m512i round = _mm512_set1_epi32(1 << (shift - 1)), v;
+	__m128i bits = _mm_cvtsi32_si128(shift);
+	size_t k;
+
+	for (k = 0; k + 16 <= count; k += 16) {
+		v = _mm512_srl_epi32(_mm512_add_epi32(_mm512_loadu_si512(total + k), round), bits);
+		_mm256_storeu_si256((__m256i *)(dst + k), _mm512_cvtepi32_epi16(v));
+	}
+	narrow16Scalar(dst + k, total + k, count - k, shift);
+}
+
+TARGET("avx512f,avx512bw") static void minMaxAvx512(unsigned char *low, unsigned char *high, size_t count)
+{
+	__m512i a, b;
+	size_t k;
+
+	for (k = 0; k + 64 <= count; k += 64) {
+		a = _mm512_loadu_si512(low + k);
+		b = _mm512_loadu_si512(high + k);
+		_mm512_storeu_si512(low + k, _mm512_min_epu8(a, b));
+		_mm512_storeu_si512(high + k, _mm512_max_epu8(a, b));
+	}
+	minMaxScalar(low + k, high + k, count - k);
+}
+
+TARGET("avx512f,avx512bw") static void minMax16Avx512(unsigned short *low, unsigned short *high, size_t count)
+{
+	__m512i a, b;
+	size_t k;
+
+	for (k = 0; k + 32 <= count; k += 32) {
+		a = _mm512_loadu_si512(low + k);
+		b = _mm512_loadu_si512(high + k);
+		_mm512_storeu_si512(low + k, _mm512_min_epu16(a, b));
+		_mm512_storeu_si512(high + k, _mm512_max_epu16(a, b));
+	}
+	minMax16Scalar(low + k, high + k, count - k);
+}
+
+TARGET("avx512f,avx512bw") static void resampleAvx512(unsigned char *dst, const unsigned char *const *rows, const short *weights,
+	int taps, size_t count, unsigned int maxval)
+{
+	__m512i round = _mm512_set1_epi32(1 << (RESAMPLE_BITS - 1)), zero = _mm512_setzero_si512();
+	__m512i max = _mm512_set1_epi16((short)maxval), a, b, w, low, high;
+	size_t k;
+	int t;
+
+	for (k = 0; k + 32 <= count; k += 32) {
+		low = high = round;
+		for (t = 0; t < taps; t += 2) {
+			a = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i *)(rows[t] + k)));
+			b = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i *)(rows[t + 1] + k)));
+			w = _mm512_set1_epi32(weightPair(weights, t));
+			low = _mm512_add_epi32(low, _mm512_madd_epi16(_mm512_unpacklo_epi16(a, b), w));
+			high = _mm512_add_epi32(high, _mm512_madd_epi16(_mm512_unpackhi_epi16(a, b), w));
+		}
+		a = _mm512_packs_epi32(_mm512_srai_epi32(low, RESAMPLE_BITS), _mm512_srai_epi32(high, RESAMPLE_BITS));
+		a = _mm512_min_epi16(_mm512_max_epi16(a, zero), max);
+		_mm256_storeu_si256((__m256i *)(dst + k), _mm512_cvtepi16_epi8(a));
+	}
+	resampleFrom(dst, rows, weights, taps, k, count, maxval);
+}
+
+TARGET("avx512f,avx512bw") static void resample16Avx512(unsigned short *dst, const unsigned short *const *rows, const short *weights,
+	int taps, size_t count, unsigned int maxval)
+{
+	__m512i round = _mm512_set1_epi32((1 << (RESAMPLE_BITS - 1)) + (32768 << RESAMPLE_BITS)), bias = _mm512_set1_epi32(32768);
+	__m512i sign = _mm512_set1_epi16((short)0x8000), max = _mm512_set1_epi16((short)(maxval - 32768)), a, b, w, low, high;
+	size_t k;
+	int t;
+
+	for (k = 0; k + 32 <= count; k += 32) {
+		low = high = round;
+		for (t = 0; t < taps; t += 2) {
+			a = _mm512_xor_si512(_mm512_loadu_si512(rows[t] + k), sign);
+			b = _mm512_xor_si512(_mm512_loadu_si512(rows[t + 1] + k), sign);
+			w = _mm512_set1_epi32(weightPair(weights, t));
+			low = _mm512_add_epi32(low, _mm512_madd_epi16(_mm512_unpacklo_epi16(a, b), w));
+			high = _mm512_add_epi32(high, _mm512_madd_epi16(_mm512_unpackhi_epi16(a, b), w));
+		}
+		a = _mm512_packs_epi32(_mm512_sub_epi32(_mm512_srai_epi32(low, RESAMPLE_BITS), bias),
+			_mm512_sub_epi32(_mm512_srai_epi32(high, RESAMPLE_BITS), bias));
+		_mm512_storeu_si512(dst + k, _mm512_xor_si512(_mm512_min_epi16(a, max), sign));
+	}
+	resample16From(dst, rows, weights, taps, k, count, maxval);
+}
+
+static const SimdKernels avx512Kernels = {
+	SIMD_AVX512, invertAvx512, invert16Avx512, accumulate8Avx512, accumulateAvx512, slideAvx512,
+	narrowAvx512, narrow16Avx512, minMaxAvx512, minMax16Avx512, resampleAvx512, resample16Avx512,
+	transposeAvx2 // the 8 x 8 blocks don't fill wider registers
+};
+#endif
+
+// Kernels of each level, NULL when the compiler can't build them
+static const SimdKernels *levelKernels[] = {
+	&scalarKernels,
+#ifdef HAVE_SSE2
+	&sse2Kernels,
+#else
+	NULL,
+#endif
+#ifdef HAVE_AVX2
+	&avx2Kernels,
+#else
+	NULL,
+#endif
+#ifdef HAVE_AVX512
+	&avx512Kernels,
+#else
+	NULL,
+#endif
+};
+
+static int detectedLevel = SIMD_SCALAR;
+static int maxLevel = SIMD_AVX512;
+static pthread_once_t detectOnce = PTHREAD_ONCE_INIT;
+
+#if defined(HAVE_AVX2) || defined(HAVE_AVX512)
+static void cpuid(int leaf, int subleaf, unsigned int regs[4])
+{
+#ifdef _MSC_VER
+	__cpuidex((int *)regs, leaf, subleaf);
+#else
+	__cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// Register state the system saves on context switches, wide registers are only usable when it does
+static unsigned long long enabledState(void)
+{
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	unsigned int low, high;
+	__asm__ volatile ("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+	return ((unsigned long long)high << 32) | low;
+#endif
+}
+#endif
+
+static void detectLevel(void)
+{
+#if defined(HAVE_AVX2) || defined(HAVE_AVX512)
+	unsigned int regs[4], maxLeaf;
+	unsigned long long state;
+#endif
+
+#ifdef HAVE_SSE2
+	detectedLevel = SIMD_SSE2;
+#endif
+
+#if defined(HAVE_AVX2) || defined(HAVE_AVX512)
+	cpuid(0, 0, regs);
+	maxLeaf = regs[0];
+	cpuid(1, 0, regs);
+	// OSXSAVE and AVX, then the XMM and YMM state enabled by the system
+	if (maxLeaf < 7 || (regs[2] & (1u << 27 | 1u << 28)) != (1u << 27 | 1u << 28))
+		return;
+	state = enabledState();
+	if ((state & 0x6) != 0x6)
+		return;
+
+	cpuid(7, 0, regs);
+#ifdef HAVE_AVX2
+	if (regs[1] & 1u << 5)
+		detectedLevel = SIMD_AVX2;
+#endif
+#ifdef HAVE_AVX512
+	// AVX-512 F and BW, with the opmask and ZMM state enabled as well
+	if (detectedLevel == SIMD_AVX2 && (regs[1] & (1u << 16 | 1u << 30)) == (1u << 16 | 1u << 30) &&
+		(state & 0xE0) == 0xE0)
+		detectedLevel = SIMD_AVX512;
+#endif
+#endif
+}
+
+const SimdKernels *simdKernels(void)
+{
+	int level;
+
+	pthread_once(&detectOnce, detectLevel);
+	level = detectedLevel < maxLevel ? detectedLevel : maxLevel;
+	while (!levelKernels[level])
+		level--;
+	return levelKernels[level];
+}
+
+void setSimdLevel(int level)
+{
+	maxLevel = level < SIMD_SCALAR ? SIMD_SCALAR : level > SIMD_AVX512 ? SIMD_AVX512 : level;
+}
+
+const char *simdLevelName(int level)
+{
+	static const char *names[] = { "scalar", "sse2", "avx2", "avx512" };
+
+	return level >= SIMD_SCALAR && level <= SIMD_AVX512 ? names[level] : "unknown";
+}
@@ -0,0 +1,60 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <stddef.h>
+
+// Instruction sets of the kernels, from the narrowest to the widest
+#define SIMD_SCALAR 0
+#define SIMD_SSE2 1 // 16 bytes per instruction
+#define SIMD_AVX2 2 // 32 bytes per instruction
+#define SIMD_AVX512 3 // 64 bytes per instruction, with AVX-512 BW for the 8 and 16 bits operations
+
+#define RESAMPLE_BITS 14 // Fraction bits of the resampling weights, 1 << RESAMPLE_BITS stands for 1
+
+// Inner loops of the filters over flat runs of samples, every instruction set gives the same results
+typedef struct {
+	int level;
+
+	// samples = maxval - samples
+	void (*invert)(unsigned char *samples, size_t count, unsigned int maxval);
+	void (*invert16)(unsigned short *samples, size_t count, unsigned int maxval);
+
+	// total += weight * src, weight goes up to 65536
+	void (*accumulate8)(unsigned int *total, const unsigned char *src, size_t count, unsigned int weight);
+	void (*accumulate)(unsigned int *total, const unsigned short *src, size_t count, unsigned int weight);
+
+	// total += in - out, the totals of a sliding window
+	void (*slide)(unsigned int *total, const unsigned short *in, const unsigned short *out, size_t count);
+
+	// dst = (total + rounding) >> shift, shift is 1 or more and the results must fit dst
+	void (*narrow)(unsigned char *dst, const unsigned int *total, size_t count, int shift);
+	void (*narrow16)(unsigned short *dst, const unsigned int *total, size_t count, int shift);
+
+	// low, high = min(low, high), max(low, high), a step of a sorting network
+	void (*minMax)(unsigned char *low, unsigned char *high, size_t count);
+	void (*minMax16)(unsigned short *low, unsigned short *high, size_t count);
+
+	// dst = sum of weights[t] * rows[t] for t below taps, rounded and clamped to 0 to maxval. taps is
+	// even, the weights are signed fixed-point numbers of RESAMPLE_BITS fraction bits adding up to 1.
+	void (*resample)(unsigned char *dst, const unsigned char *const *rows, const short *weights, int taps,
+		size_t count, unsigned int maxval);
+	void (*resample16)(unsigned short *dst, const unsigned short *const *rows, const short *weights, int taps,
+		size_t count, unsigned int maxval);
+
+	// Block of 8 x 8 pixels of pixelSize bytes (1, 2, 3 or 6) turned over its diagonal, row r of dst
+	// getting column r of src. The strides may be negative to walk the rows upwards.
+	void (*transpose)(unsigned char *dst, ptrdiff_t dstStride, const unsigned char *src, ptrdiff_t srcStride, int pixelSize);
+} SimdKernels;
+
+// Kernels of the widest instruction set both the processor and the system support,
+// found with CPUID on the first call
+const SimdKernels *simdKernels(void);
+
+// Highest level simdKernels() may pick, SIMD_AVX512 by default. It lets the benchmark compare
+// instruction sets, set it before running filters.
+void setSimdLevel(int level);
+
+// Name of a level, "scalar", "sse2", "avx2" or "avx512"
+const char *simdLevelName(int level);
+
+#endif
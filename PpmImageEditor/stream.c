@@ -0,0 +1,194 @@
+#include "platform.h"
+#include "stream.h"
+#include "image.h"
+#include "filters.h"
+#include "resize.h"
+#include <stdlib.h>
+#include <string.h>
+
+size_t streamMeanBlur(const char *input, const char *output, int radius)
+{
+	FILE *in, *out;
+	errno_t err;
+	ImageHeader header;
+	char text[IMAGE_HEADER_MAX], *tempName;
+	size_t textLength;
+	unsigned char *ring, *band;
+	unsigned int *sums;
+	size_t memory;
+	int depth, ringRows, rowsRead = 0, rowsDone = 0, need, slot, count, k;
+	size_t rowSize;
+
+	//open both files
+	err = fopen_s(&in, input, "rb");
+	if (err != 0) {
+		fprintf(stderr, "Unable to open file '%s'\n", input);
+		exit(1);
+	}
+
+	if (!readImageHeader(in, input, &header)) {
+		fprintf(stderr, "Empty file '%s'\n", input);
+		exit(1);
+	}
+
+	if (header.format != '6' && header.format != '5') {
+		fprintf(stderr, "Invalid image format (must be 'P6' or 'P5')\n");
+		exit(1);
+	}
+
+	// the ring keeps the window of the last row of a band plus the band itself
+	radius = radius < 1 ? 1 : radius < MEAN_MAX_RADIUS ? radius : MEAN_MAX_RADIUS;
+	depth = header.maxval > RGB_TOTAL_COLORS ? 2 : 1;
+	rowSize = (size_t)header.x * header.channels * depth;
+	ringRows = 2 * radius + 1 + STREAM_BAND;
+	memory = (ringRows + STREAM_BAND) * rowSize + (size_t)header.x * header.channels * sizeof(unsigned int);
+	ring = (unsigned char *)malloc(ringRows * rowSize);
+	band = (unsigned char *)malloc(STREAM_BAND * rowSize);
+	sums = (unsigned int *)malloc((size_t)header.x * header.channels * sizeof(unsigned int));
+	if (!ring || !band || !sums) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	// the output has the size of the input, written under a temporary name until it is complete
+	textLength = formatImageHeader(text, header.format, header.x, header.y, header.maxval);
+	out = createOutputFile(output, &tempName, textLength + (unsigned long long)rowSize * header.y);
+	fwrite(text, 1, textLength, out);
+
+	while (rowsDone < header.y) {
+		// read every row the next band needs, the ring wraps around so it may take two reads
+		need = rowsDone + STREAM_BAND + radius;
+		if (need > header.y)
+			need = header.y;
+		while (rowsRead < need) {
+			slot = rowsRead % ringRows;
+			count = need - rowsRead < ringRows - slot ? need - rowsRead : ringRows - slot;
+			if (fread(ring + slot * rowSize, rowSize, count, in) != (size_t)count) {
+				fprintf(stderr, "Truncated pixel data (error loading '%s')\n", input);
+				exit(1);
+			}
+			if (depth == 2)
+				bigEndianSamples((unsigned short *)(ring + slot * rowSize), (size_t)header.x * header.channels * count);
+			rowsRead += count;
+		}
+
+		// blur the band and write it out right away
+		count = header.y - rowsDone < STREAM_BAND ? header.y - rowsDone : STREAM_BAND;
+		for (k = 0; k < count; k++)
+			meanBlurRow(ring, ringRows, rowSize, header.x, header.y, header.channels, depth, radius, rowsDone + k, sums,
+				band + k * rowSize);
+		if (depth == 2)
+			bigEndianSamples((unsigned short *)band, (size_t)header.x * header.channels * count);
+		fwrite(band, rowSize, count, out);
+		rowsDone += count;
+	}
+
+	free(sums);
+	free(band);
+	free(ring);
+	commitOutputFile(out, output, tempName);
+	fclose(in);
+	return memory;
+}
+
+Image *readImageDecimated(const char *filename, int factor)
+{
+	FILE *in;
+	errno_t err;
+	ImageHeader header;
+	Image *img, *small;
+	unsigned char *band;
+	unsigned int *totals;
+	int depth, count, j;
+	size_t rowSize;
+
+	err = fopen_s(&in, filename, "rb");
+	if (err != 0) {
+		fprintf(stderr, "Unable to open file '%s'\n", filename);
+		exit(1);
+	}
+
+	if (!readImageHeader(in, filename, &header)) {
+		fprintf(stderr, "Empty file '%s'\n", filename);
+		exit(1);
+	}
+
+	// the other formats are loaded whole, then shrunk
+	if (header.format != '6' && header.format != '5') {
+		fclose(in);
+		img = readImage(filename);
+		small = decimateImage(img, factor);
+		freeImage(img);
+		return small;
+	}
+
+	depth = header.maxval > RGB_TOTAL_COLORS ? 2 : 1;
+	rowSize = (size_t)header.x * header.channels * depth;
+	small = createImage((header.x + factor - 1) / factor, (header.y + factor - 1) / factor, header.channels, header.maxval, 0);
+	band = (unsigned char *)malloc(factor * rowSize);
+	totals = (unsigned int *)malloc((size_t)header.x * header.channels * sizeof(unsigned int));
+	if (!small || !band || !totals) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	// a band of factor rows at a time gives a row of the small image
+	small->format = header.format;
+	for (j = 0; j < small->y; j++) {
+		count = header.y - j * factor < factor ? header.y - j * factor : factor;
+		if (fread(band, rowSize, count, in) != (size_t)count) {
+			fprintf(stderr, "Truncated pixel data (error loading '%s')\n", filename);
+			exit(1);
+		}
+		if (depth == 2)
+			bigEndianSamples((unsigned short *)band, (size_t)header.x * header.channels * count);
+		decimateRows(band, rowSize, count, header.x, header.channels, depth, factor, totals, imageSamples(small, j));
+	}
+
+	free(totals);
+	free(band);
+	fclose(in);
+	return small;
+}
+
+int streamFrames(FILE *in, FILE *out, const char *name, const Pipeline *pipeline)
+{
+	ImageHeader header;
+	PipelineScratch scratch;
+	Image *img = NULL;
+	int frames = 0;
+
+	// the filtered frames and the frames they replace take turns, with the tile buffers
+	memset(&scratch, 0, sizeof(scratch));
+
+	while (readImageHeader(in, name, &header)) {
+		// text pixels are parsed in large blocks, which would eat the next frames
+		if (header.format == '3' || header.format == '2') {
+			fprintf(stderr, "Invalid image format (must be 'P6', 'P5' or 'P4')\n");
+			exit(1);
+		}
+
+		// a new image is only needed when the frame size changes
+		if (!img || img->x != header.x || img->y != header.y || img->channels != header.channels ||
+			img->maxval != header.maxval) {
+			freeImage(img);
+			img = createImage(header.x, header.y, header.channels, header.maxval, 0);
+			if (!img) {
+				fprintf(stderr, "Unable to allocate memory\n");
+				exit(1);
+			}
+		}
+
+		readImagePixels(in, name, img, header.format);
+		img->format = header.format;
+		img = runPipelineScratch(pipeline, img, &scratch);
+		writeImageHeader(out, imageFormat(img), img->x, img->y, img->maxval);
+		writeImagePixels(out, img);
+		frames++;
+	}
+
+	fflush(out);
+	freeImage(img);
+	freePipelineScratch(&scratch);
+	return frames;
+}
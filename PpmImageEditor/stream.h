@@ -0,0 +1,24 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "image.h"
+#include "pipeline.h"
+
+#define STREAM_BAND 16 // Rows read, blurred and written at once by the streaming filters
+
+// Mean blur of radius radius (see filterMeanBlurPasses()) of a P6 or P5 file into another file,
+// without loading the whole image. Only the 2 * radius + 1 rows around the STREAM_BAND rows being
+// blurred are kept in memory, so the memory used depends on the image width and not on its height.
+// The radius goes from 1 to MEAN_MAX_RADIUS. Returns the bytes of the buffers it used.
+size_t streamMeanBlur(const char *input, const char *output, int radius);
+
+// Load an image shrunk by factor, as decimateImage() does. P6 and P5 files are read factor rows at
+// a time, so the whole image is never in memory, the other formats are loaded then shrunk.
+Image *readImageDecimated(const char *filename, int factor);
+
+// Run pipeline on every image of a stream of concatenated binary images (frames, P6, P5 or P4), as
+// read from a pipe, writing each filtered frame to out. The image is reused while the frames keep
+// the same size, channels and maxval. Returns the number of frames.
+int streamFrames(FILE *in, FILE *out, const char *name, const Pipeline *pipeline);
+
+#endif
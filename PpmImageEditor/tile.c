@@ -0,0 +1,74 @@
+#include "platform.h"
+#include "tile.h"
+#include "parallel.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// Structure for the tiles of a run
+typedef struct {
+	const Image *img;
+	int tileWidth, tileHeight;
+	int columns; // Tiles per row
+	TileTask task;
+	void *arg;
+} TileRun;
+
+static int forcedWidth = 0, forcedHeight = 0;
+
+static void rangeTiles(void *arg, int start, int end, int worker)
+{
+	TileRun *run = (TileRun *)arg;
+	Tile tile;
+	int t;
+
+	for (t = start; t < end; t++) {
+		tile.x0 = t % run->columns * run->tileWidth;
+		tile.y0 = t / run->columns * run->tileHeight;
+		tile.x1 = tile.x0 + run->tileWidth < run->img->x ? tile.x0 + run->tileWidth : run->img->x;
+		tile.y1 = tile.y0 + run->tileHeight < run->img->y ? tile.y0 + run->tileHeight : run->img->y;
+		run->task(run->arg, &tile, worker);
+	}
+}
+
+void tileRun(const Image *img, int tileWidth, int tileHeight, TileTask task, void *arg)
+{
+	TileRun run;
+
+	run.img = img;
+	run.tileWidth = tileWidth > 0 ? tileWidth : img->x;
+	run.tileHeight = tileHeight > 0 ? tileHeight : img->y;
+	run.columns = (img->x + run.tileWidth - 1) / run.tileWidth;
+	run.task = task;
+	run.arg = arg;
+
+	// one tile at a time, tiles are large enough for the hand out to cost nothing
+	parallelFor(0, run.columns * ((img->y + run.tileHeight - 1) / run.tileHeight), 1, rangeTiles, &run);
+}
+
+void tileSize(const Image *img, int halo, size_t bytesPerPixel, int *tileWidth, int *tileHeight)
+{
+	size_t budget = cacheSizeL2() / 2;
+	int width, height;
+
+	// full rows for narrow images, the height then fills the budget with the halo rows
+	width = forcedWidth > 0 ? forcedWidth : img->x < TILE_MAX_WIDTH ? img->x : TILE_MAX_WIDTH;
+	if (forcedHeight > 0)
+		height = forcedHeight;
+	else {
+		height = (int)(budget / (bytesPerPixel * (width + 2 * (size_t)halo))) - 2 * halo;
+		// tiles much lower than their halo would spend most of their time on it
+		if (height < halo)
+			height = halo;
+		if (height < TILE_MIN_HEIGHT)
+			height = TILE_MIN_HEIGHT;
+	}
+
+	*tileWidth = width < img->x ? width : img->x;
+	*tileHeight = height < img->y ? height : img->y;
+}
+
+void setTileSize(int width, int height)
+{
+	forcedWidth = width;
+	forcedHeight = height;
+}
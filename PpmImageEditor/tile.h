@@ -0,0 +1,30 @@
+#ifndef TILE_H
+#define TILE_H
+
+#include "image.h"
+
+#define TILE_MAX_WIDTH 512 // Widest automatic tile, wide enough for long vector runs along the rows
+#define TILE_MIN_HEIGHT 8 // Lowest automatic tile
+
+// Rectangle of an image, columns x0 to x1 - 1 and rows y0 to y1 - 1
+typedef struct {
+	int x0, y0, x1, y1;
+} Tile;
+
+// Work done on a tile. worker goes from 0 to parallelThreads() - 1 and no two tiles run at once
+// with the same worker, so it can index scratch memory allocated per worker.
+typedef void (*TileTask)(void *arg, const Tile *tile, int worker);
+
+// Cut img in tiles of tileWidth x tileHeight pixels, the last tiles of a row or column taking
+// what is left so every pixel is covered, and run task on all of them. The workers take the
+// tiles in row order as they become free, so a slow tile doesn't hold up the others.
+void tileRun(const Image *img, int tileWidth, int tileHeight, TileTask task, void *arg);
+
+// Tile size of a filter that reads halo pixels around each tile and keeps bytesPerPixel bytes of
+// buffers for every pixel of a tile and its halo. The automatic size keeps them in half the L2 cache.
+void tileSize(const Image *img, int halo, size_t bytesPerPixel, int *tileWidth, int *tileHeight);
+
+// Force the tile size, 0 lets tileSize() pick that side
+void setTileSize(int width, int height);
+
+#endif